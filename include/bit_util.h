@@ -43,4 +43,11 @@ int bit_clear(int value, int bit);
  */
 int bit_toggle(int value, int bit);
 
+/**
+ * Finds the first (least significant) bit that is set
+ * @param value - the integer value to search
+ * @return index of the first set bit, -1 if no bits are set
+ */
+int bit_find_first(int value);
+
 #endif
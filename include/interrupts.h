@@ -76,6 +76,7 @@ __BEGIN_DECLS
 extern void isr_entry_timer();
 extern void isr_entry_keyboard();
 extern void isr_entry_syscall();
+extern void isr_entry_sysenter();
 
 __END_DECLS
 #endif
@@ -30,6 +30,35 @@ typedef enum log_level {
     KERNEL_LOG_LEVEL_ALL    // Log everything!
 } log_level_t;
 
+// Kernel subsystems with independent log levels
+typedef enum log_subsys {
+    KERNEL_LOG_SUBSYS_KERNEL,       // Everything not listed below
+    KERNEL_LOG_SUBSYS_SCHEDULER,    // Scheduler
+    KERNEL_LOG_SUBSYS_TIMER,        // Timer
+    KERNEL_LOG_SUBSYS_KEYBOARD,     // Keyboard driver
+    KERNEL_LOG_SUBSYS_TTY,          // TTY and VGA drivers
+    KERNEL_LOG_SUBSYS_SYSCALL,      // System calls
+    KERNEL_LOG_SUBSYS_KPROC,        // Process management
+    KERNEL_LOG_SUBSYS_WORKQUEUE,    // Work queues
+    KERNEL_LOG_SUBSYS_KMALLOC,      // Kernel heap
+    KERNEL_LOG_SUBSYS_MAX
+} log_subsys_t;
+
+// Highest log level compiled into the kernel
+// Log statements above this level are removed at compile time
+#ifndef KERNEL_LOG_LEVEL_MAX
+#define KERNEL_LOG_LEVEL_MAX KERNEL_LOG_LEVEL_TRACE
+#endif
+
+// Subsystem that log statements in the current file belong to
+// Source files define this before including any headers
+#ifndef KERNEL_LOG_SUBSYS
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_KERNEL
+#endif
+
+// Current log level of each subsystem
+extern int kernel_log_levels[KERNEL_LOG_SUBSYS_MAX];
+
 // Global pointer to the current active process entry
 extern proc_t *active_proc;
 
@@ -44,13 +73,38 @@ void kernel_init(void);
  * Function declarations
  */
 
+/**
+ * Prints a kernel log message to the host
+ * Called through the kernel_log_* macros, which check the log level
+ *
+ * @param level - log level of the message
+ * @param msg - string format for the message to be displayed
+ * @param ... - variable arguments to pass in to the string format
+ */
+void kernel_log_write(int level, char *msg, ...);
+
+/**
+ * Prints a kernel log message if the level is compiled in and enabled for
+ * the current subsystem
+ * The arguments are not evaluated when the message is not logged
+ *
+ * @param level - log level of the message
+ * @param msg - string format for the message to be displayed
+ * @param ... - variable arguments to pass in to the string format
+ */
+#define kernel_log(level, msg, ...) do { \
+    if ((level) <= KERNEL_LOG_LEVEL_MAX && (level) <= kernel_log_levels[KERNEL_LOG_SUBSYS]) { \
+        kernel_log_write((level), (msg), ##__VA_ARGS__); \
+    } \
+} while (0)
+
 /**
  * Prints a kernel log message to the host with an error log level
  *
  * @param msg - string format for the message to be displayed
  * @param ... - variable arguments to pass in to the string format
  */
-void kernel_log_error(char *msg, ...);
+#define kernel_log_error(msg, ...) kernel_log(KERNEL_LOG_LEVEL_ERROR, msg, ##__VA_ARGS__)
 
 /**
  * Prints a kernel log message to the host with a warning log level
@@ -58,7 +112,7 @@ void kernel_log_error(char *msg, ...);
  * @param msg - string format for the message to be displayed
  * @param ... - variable arguments to pass in to the string format
  */
-void kernel_log_warn(char *msg, ...);
+#define kernel_log_warn(msg, ...) kernel_log(KERNEL_LOG_LEVEL_WARN, msg, ##__VA_ARGS__)
 
 /**
  * Prints a kernel log message to the host with an info log level
@@ -66,7 +120,7 @@ void kernel_log_warn(char *msg, ...);
  * @param msg - string format for the message to be displayed
  * @param ... - variable arguments to pass in to the string format
  */
-void kernel_log_info(char *msg, ...);
+#define kernel_log_info(msg, ...) kernel_log(KERNEL_LOG_LEVEL_INFO, msg, ##__VA_ARGS__)
 
 /**
  * Prints a kernel log message to the host with a debug log level
@@ -74,7 +128,7 @@ void kernel_log_info(char *msg, ...);
  * @param msg - string format for the message to be displayed
  * @param ... - variable arguments to pass in to the string format
  */
-void kernel_log_debug(char *msg, ...);
+#define kernel_log_debug(msg, ...) kernel_log(KERNEL_LOG_LEVEL_DEBUG, msg, ##__VA_ARGS__)
 
 /**
  * Prints a kernel log message to the host with a trace log level
@@ -82,7 +136,7 @@ void kernel_log_debug(char *msg, ...);
  * @param msg - string format for the message to be displayed
  * @param ... - variable arguments to pass in to the string format
  */
-void kernel_log_trace(char *msg, ...);
+#define kernel_log_trace(msg, ...) kernel_log(KERNEL_LOG_LEVEL_TRACE, msg, ##__VA_ARGS__)
 
 /**
  * Triggers a kernel panic that does the following:
@@ -102,12 +156,20 @@ void kernel_panic(char *msg, ...);
 int kernel_get_log_level(void);
 
 /**
- * Sets the new log level and returns the value set
+ * Sets the new log level of all subsystems and returns the value set
  * @param level - the log level to set
  * @return the kernel log level
  */
 int kernel_set_log_level(int level);
 
+/**
+ * Sets the log level of a single subsystem
+ * @param subsys - the subsystem
+ * @param level - the log level to set
+ * @return the subsystem log level, -1 on error
+ */
+int kernel_set_subsys_log_level(int subsys, int level);
+
 /**
  * Exits the kernel
  */
@@ -80,5 +80,13 @@ unsigned int keyboard_getc(void);
  * For any character that cannot be mapped, KEY_NULL should be returned.
  */
 unsigned int keyboard_decode(unsigned int c);
+
+/**
+ * Keyboard work
+ * Decodes one queued scancode and performs the resulting TTY input or
+ * kernel command; requeues itself while scancodes remain so interrupts
+ * are serviced in between
+ */
+void keyboard_work(void);
 #endif
 #endif
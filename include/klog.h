@@ -0,0 +1,69 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Kernel Log Buffer
+ */
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <spede/stdarg.h>
+
+#ifndef KLOG_SIZE
+#define KLOG_SIZE       256     // Number of records in the log buffer (must be a power of two)
+#endif
+
+#if (KLOG_SIZE & (KLOG_SIZE - 1)) != 0
+#error "KLOG_SIZE must be a power of two"
+#endif
+
+#define KLOG_MASK       (KLOG_SIZE - 1)
+
+#define KLOG_ARGS       6       // Maximum number of arguments per log message
+#define KLOG_STR_SIZE   64      // Space for copies of string (%s) arguments per log message
+
+#ifndef KLOG_DRAIN_MS
+#define KLOG_DRAIN_MS   100     // Interval (in milliseconds) between checks for records to drain
+#endif
+
+// Log record
+// Messages are stored unformatted and are formatted when drained
+typedef struct klog_record_t {
+    unsigned int ticks;             // Timer ticks when the message was logged
+    int level;                      // Log level
+    char *fmt;                      // Message format (must be a string literal)
+    int nargs;                      // Number of arguments
+    unsigned int strings;           // Arguments that are offsets into str (one bit per argument)
+    unsigned int args[KLOG_ARGS];   // Raw argument values
+    char str[KLOG_STR_SIZE];        // Copies of string arguments
+} klog_record_t;
+
+/**
+ * Initializes the log drain
+ * Creates the log drain process and the timer callback that wakes it
+ */
+void klog_init(void);
+
+/**
+ * Adds a log message to the log buffer
+ * The message is dropped if the log buffer is full
+ * @param level - log level
+ * @param fmt - message format (must remain valid until drained)
+ * @param args - message arguments
+ */
+void klog_write(int level, char *fmt, va_list args);
+
+/**
+ * Formats and prints all messages in the log buffer to the host
+ * @return number of messages printed
+ */
+int klog_flush(void);
+
+/**
+ * Log drain process
+ * Prints the contents of the log buffer at the lowest priority so logging
+ * does not delay interrupt handling; blocks while the buffer is empty
+ */
+void klog_proc(void);
+
+#endif
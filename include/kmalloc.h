@@ -0,0 +1,87 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Kernel Heap Allocator
+ */
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include <spede/stddef.h>
+
+#ifndef KMALLOC_HEAP_SIZE
+#define KMALLOC_HEAP_SIZE   (1024 * 1024)   // Size of the kernel heap
+#endif
+
+#define KMALLOC_PAGE_SIZE   4096            // Size of a heap page
+#define KMALLOC_PAGES       (KMALLOC_HEAP_SIZE / KMALLOC_PAGE_SIZE)
+
+#define KMALLOC_MIN_SHIFT   4               // Smallest size class (16 bytes)
+#define KMALLOC_MAX_SHIFT   13              // Largest size class (8192 bytes)
+
+// Number of size classes (powers of two from the smallest to the largest)
+#define KMALLOC_CLASSES     (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+// Statistics index of allocations larger than the largest size class
+#define KMALLOC_CLASS_LARGE KMALLOC_CLASSES
+
+#if (KMALLOC_HEAP_SIZE % KMALLOC_PAGE_SIZE) != 0
+#error "KMALLOC_HEAP_SIZE must be a multiple of KMALLOC_PAGE_SIZE"
+#endif
+
+// Size class statistics
+typedef struct kmalloc_stats_t {
+    size_t size;            // Object size (0 for large allocations)
+    int slabs;              // Number of slabs allocated to the class
+    int objects;            // Total number of objects in the slabs
+    int pages;              // Number of heap pages held by the class
+    int in_use;             // Number of objects allocated
+    int allocs;             // Number of allocations
+    int frees;              // Number of frees
+    int failures;           // Number of allocations that failed
+} kmalloc_stats_t;
+
+/**
+ * Initializes the kernel heap
+ */
+void kmalloc_init(void);
+
+/**
+ * Allocates memory from the kernel heap
+ * Requests are rounded up to a power of two size class; requests larger
+ * than the largest class are allocated whole pages. Freed page runs are
+ * not merged, so large allocations fragment the heap over time
+ * @param size - number of bytes to allocate
+ * @return pointer to the allocated memory, NULL on error
+ */
+void *kmalloc(size_t size);
+
+/**
+ * Frees memory allocated by kmalloc
+ * @param ptr - pointer to the memory (NULL is ignored)
+ */
+void kfree(void *ptr);
+
+/**
+ * Allocates contiguous pages from the kernel heap
+ * @param pages - number of pages
+ * @return pointer to the first page, NULL on error
+ */
+void *kpage_alloc(int pages);
+
+/**
+ * Frees pages allocated by kpage_alloc
+ * @param ptr - pointer to the first page
+ * @param pages - number of pages
+ */
+void kpage_free(void *ptr, int pages);
+
+/**
+ * Returns the statistics for a size class
+ * @param class - size class (0 to KMALLOC_CLASSES-1, or KMALLOC_CLASS_LARGE)
+ * @param stats - pointer to the statistics to fill in
+ * @return 0 on success, -1 on error
+ */
+int kmalloc_get_stats(int class, kmalloc_stats_t *stats);
+
+#endif
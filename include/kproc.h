@@ -10,9 +10,10 @@
 #include "trapframe.h"
 #include "ringbuf.h"
 #include "queue.h"
+#include "timer.h"
 
 #ifndef PROC_MAX
-#define PROC_MAX        20   // maximum number of processes to support
+#define PROC_MAX        64   // maximum number of processes to support
 #endif
 
 #define PROC_IO_MAX     4    // Maximum process I/O buffers
@@ -44,6 +45,8 @@ typedef struct proc_t {
     int pid;                        // Process id
     state_t state;                  // Process state
     proc_type_t type;               // Process type (kernel or user)
+    int priority;                   // Scheduling priority (PROC_PRIORITY_MAX is highest)
+    int base_priority;              // Priority the process returns to when boosted
 
     char name[PROC_NAME_LEN];       // Process name
 
@@ -51,10 +54,12 @@ typedef struct proc_t {
     int run_time;                   // Total run time of the process
     int cpu_time;                   // Current CPU time the process has used
     int sleep_time;                 // Time that a process should be sleeping
+    timer_event_t sleep_event;      // Timer event used to wake the process
 
     queue_t *scheduler_queue;       // Pointer to the queue where the process resides
 
     ringbuf_t *io[PROC_IO_MAX];     // Process input/output buffers
+    struct tty_t *tty;              // Attached TTY (NULL if none)
 
     unsigned char *stack;           // Pointer to the process stack
     trapframe_t *trapframe;         // Pointer to the trapframe
@@ -9,12 +9,37 @@
 
 #include "syscall_common.h"
 
+// Enable the SYSENTER system call entry (if supported by the CPU)
+#ifndef KSYSCALL_SYSENTER
+#define KSYSCALL_SYSENTER 1
+#endif
+
+// Registers saved by the SYSENTER entry (see isr_entry_sysenter)
+typedef struct ksyscall_frame_t {
+    unsigned int eax;      // System call identifier / return value
+    unsigned int ebx;      // First argument
+    unsigned int ecx;      // Second argument
+    unsigned int edx;      // Third argument
+    unsigned int esi;      // Return address
+    unsigned int edi;
+    unsigned int ebp;      // Caller stack pointer (points to the saved EFLAGS)
+    unsigned int eflags;   // Caller EFLAGS
+} ksyscall_frame_t;
+
 /**
  * System call IRQ handler
  * Dispatches system calls to the function associate with the specified system call
  */
 void ksyscall_irq_handler(void);
 
+/**
+ * SYSENTER system call handler
+ * Dispatches the system call and returns if the caller can be resumed
+ * directly; otherwise saves the caller's state and runs the scheduler
+ * @param frame - registers saved by the SYSENTER entry
+ */
+void ksyscall_sysenter_handler(ksyscall_frame_t *frame);
+
 /**
  * System Call Initialization
  */
@@ -22,6 +47,8 @@ void ksyscall_init(void);
 
 /**
  * Writes up to n bytes to the process' specified IO buffer
+ * If the buffer is full, returns PROC_IO_EAGAIN, or if PROC_IO_BLOCK is set
+ * in io, waits until space is freed and returns 0
  * @param io - the IO buffer to write to
  * @param buf - the buffer to copy from
  * @param n - number of bytes to write
@@ -31,6 +58,8 @@ int ksyscall_io_write(int io, char *buf, int n);
 
 /**
  * Reads up to n bytes from the process' specified IO buffer
+ * If PROC_IO_BLOCK is set in io and no data is available, the process
+ * waits until data is written to the buffer and 0 is returned
  * @param io - the IO buffer to read from
  * @param buf - the buffer to copy to
  * @param n - number of bytes to read
@@ -45,6 +74,14 @@ int ksyscall_io_read(int io, char *buf, int n);
  */
 int ksyscall_io_flush(int io);
 
+/**
+ * Sets the input mode of the TTY attached to the specified IO buffer
+ * @param io - the IO buffer (must be the TTY input)
+ * @param mode - input mode flags (PROC_IO_MODE_*)
+ * @return -1 on error or 0 on success
+ */
+int ksyscall_io_set_mode(int io, int mode);
+
 /**
  * Gets the current system time (in seconds)
  * @return system time in seconds
@@ -58,12 +95,40 @@ int ksyscall_sys_get_time(void);
  */
 int ksyscall_sys_get_name(char *name);
 
+/**
+ * Gets the current monotonic system time in nanoseconds
+ * @param ns - pointer to where the time will be stored
+ * @return 0 on success, -1 on error
+ */
+int ksyscall_sys_get_time_ns(unsigned long long *ns);
+
+/**
+ * Gets the address of the shared kernel data page
+ * @return address of the shared data page
+ */
+int ksyscall_sys_get_vdso(void);
+
+/**
+ * Gets the statistics for the specified system call
+ * @param syscall - system call identifier
+ * @param stats - pointer to where the statistics will be copied
+ * @return 0 on success, -1 on error
+ */
+int ksyscall_sys_get_stats(int syscall, syscall_stats_t *stats);
+
 /**
  * Puts the current process to sleep for the specified number of seconds
  * @param seconds - number of seconds the process should sleep
  */
 int ksyscall_proc_sleep(int seconds);
 
+/**
+ * Puts the current process to sleep for the specified number of nanoseconds
+ * The duration is rounded up to the timer resolution
+ * @param ns - number of nanoseconds the process should sleep
+ */
+int ksyscall_proc_sleep_ns(unsigned long long ns);
+
 /**
  * Exits the current process
  */
@@ -82,6 +147,13 @@ int ksyscall_proc_get_pid(void);
  */
 int ksyscall_proc_get_name(char *name);
 
+/**
+ * Sets the current process' scheduling priority
+ * @param priority - new priority (PROC_PRIORITY_MAX to PROC_PRIORITY_MIN)
+ * @return 0 on success, -1 on error
+ */
+int ksyscall_proc_set_priority(int priority);
+
 /**
  * Allocates a mutex from the kernel
  * @return -1 on error, all other values indicate the mutex id
@@ -10,7 +10,7 @@
 #include <spede/stdbool.h>
 
 #ifndef QUEUE_SIZE
-#define QUEUE_SIZE 32
+#define QUEUE_SIZE 64
 #endif
 
 typedef struct queue_t {
@@ -3,6 +3,12 @@
  * California State University, Sacramento
  *
  * Simple ring buffer implementation
+ *
+ * Single-producer/single-consumer (SPSC): one context may write while
+ * another reads without disabling interrupts. The head (read) index is
+ * only modified by the consumer and the tail (write) index only by the
+ * producer. Both increase monotonically and are masked when indexing the
+ * data; the number of bytes in the buffer is tail - head.
  */
 
 #ifndef RINGBUF_H
@@ -11,15 +17,25 @@
 #include <spede/stdbool.h>    // For bool type
 #include <spede/stddef.h>     // For size_t
 
+#include "queue.h"
+
 #ifndef RINGBUF_SIZE
 #define RINGBUF_SIZE 2048
 #endif
 
+#if RINGBUF_SIZE <= 0 || (RINGBUF_SIZE & (RINGBUF_SIZE - 1)) != 0
+#error "RINGBUF_SIZE must be a power of two"
+#endif
+
+// Mask used to wrap buffer indices
+#define RINGBUF_MASK (RINGBUF_SIZE - 1)
+
 typedef struct ringbuf_t {
-    int head;                   // Head of the buffer
-    int tail;                   // Tail of the buffer
-    int size;                   // Current size of the buffer
-    char data[RINGBUF_SIZE];   // Data in buffer
+    unsigned int head;          // Head of the buffer (total bytes read)
+    unsigned int tail;          // Tail of the buffer (total bytes written)
+    char data[RINGBUF_SIZE];    // Data in buffer
+    queue_t readers;            // Processes waiting for data (process ids)
+    queue_t writers;            // Processes waiting for space (process ids)
 } ringbuf_t;
 
 /**
@@ -49,12 +65,11 @@ int ringbuf_read(ringbuf_t *buf, char *byte);
 
 /**
  * Copies multiple bytes to the buffer from the specified memory
+ * Copies as many bytes as fit if the buffer does not have room for all
  * @param buf - pointer to the ring buffer structure
  * @param mem - pointer to the memory location to copy from
  * @param size - number of bytes to copy
- * @return -1 on error, 0 on success
- * @note Should return an error if the number of bytes
- *       cannot be copied - i.e. the buffer would overflow
+ * @return -1 on error, otherwise the number of bytes copied
  */
 int ringbuf_write_mem(ringbuf_t *buf, char *mem, size_t size);
 
@@ -70,6 +85,7 @@ int ringbuf_read_mem(ringbuf_t *buf, char *mem, size_t size);
 
 /**
  * Flushes (empties) the buffer
+ * Must be called by the consumer (or while the consumer cannot run)
  * @param buf - pointer to the ring buffer structure
  * @return -1 on error, 0 on success
  */
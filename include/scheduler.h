@@ -9,17 +9,52 @@
 #define SCHEDULER_H
 
 #include "kproc.h"
+#include "syscall_common.h"
 
 #ifndef SCHEDULER_TIMESLICE
 #define SCHEDULER_TIMESLICE 10
 #endif
 
+// Multi-level feedback queue (MLFQ) scheduling
+//  - Processes that use their entire time slice are demoted one level
+//    (up to SCHEDULER_MLFQ_LEVELS - 1 below their base priority)
+//  - Each level below the base priority doubles the time slice
+//  - All processes are boosted back to their base priority every
+//    SCHEDULER_MLFQ_BOOST ticks to prevent starvation
+#ifndef SCHEDULER_MLFQ
+#define SCHEDULER_MLFQ 1
+#endif
+
+#ifndef SCHEDULER_MLFQ_LEVELS
+#define SCHEDULER_MLFQ_LEVELS 4
+#endif
+
+#ifndef SCHEDULER_MLFQ_BOOST
+#define SCHEDULER_MLFQ_BOOST TIMER_HZ
+#endif
+
+// Number of run queue priority levels (one bit per level in the ready bitmap)
+#define SCHEDULER_PRIORITY_LEVELS (PROC_PRIORITY_MIN + 1)
+
+#if SCHEDULER_PRIORITY_LEVELS > 32
+#error "SCHEDULER_PRIORITY_LEVELS must fit in the 32-bit ready bitmap"
+#endif
+
 
 /**
  * Initializes the scheduler, data structures, etc.
  */
 void scheduler_init(void);
 
+/**
+ * Determines if the scheduler needs to run before returning to the
+ * active process
+ * The idle task always goes through the scheduler so tickless idle mode
+ * can be re-entered after each interrupt
+ * @return true if scheduler_run must be called
+ */
+bool scheduler_preempt_pending(void);
+
 /**
  * Executes the scheduler
  * Should ensure that `active_proc` is set to a valid process entry
@@ -38,6 +73,22 @@ void scheduler_add(proc_t *proc);
  */
 void scheduler_remove(proc_t *proc);
 
+/**
+ * Returns the time slice (in ticks) for the given process
+ * @param proc - pointer to the process entry
+ * @return number of ticks the process may run before being unscheduled
+ */
+int scheduler_timeslice(proc_t *proc);
+
+/**
+ * Sets the base scheduling priority of a process
+ * If the process is in a run queue it is moved to the new priority level
+ * @param proc - pointer to the process entry
+ * @param priority - new priority (PROC_PRIORITY_MAX to PROC_PRIORITY_MIN)
+ * @return 0 on success, -1 on error
+ */
+int scheduler_set_priority(proc_t *proc, int priority);
+
 /**
  * Puts a process to sleep
  * @param proc - pointer to the process entry
@@ -45,4 +96,17 @@ void scheduler_remove(proc_t *proc);
  */
 void scheduler_sleep(proc_t *proc, int seconds);
 
+/**
+ * Blocks a process on a wait queue
+ * @param proc - pointer to the process entry
+ * @param queue - wait queue (process ids)
+ */
+void scheduler_wait(proc_t *proc, queue_t *queue);
+
+/**
+ * Wakes all processes blocked on a wait queue
+ * @param queue - wait queue (process ids)
+ */
+void scheduler_wake(queue_t *queue);
+
 #endif
@@ -8,6 +8,22 @@
 #define SYSCALL_H
 
 #include "syscall_common.h"
+#include "vdso.h"
+
+/**
+ * Returns the shared kernel data page
+ * The address is requested from the kernel once and cached
+ * @return pointer to the shared data page
+ */
+vdso_data_t *sys_get_vdso(void);
+
+/**
+ * Measures the average round trip cost of a system call
+ * @param fast - non-zero to use the SYSENTER entry, zero to use int $0x80
+ * @param iterations - number of system calls to make
+ * @return average TSC cycles per system call, -1 on error
+ */
+int sys_bench(int fast, int iterations);
 
 /**
  * Gets the current system time (in seconds)
@@ -22,6 +38,20 @@ int sys_get_time(void);
  */
 int sys_get_name(char *name);
 
+/**
+ * Gets the current monotonic system time in nanoseconds
+ * @return time since startup in nanoseconds
+ */
+unsigned long long sys_get_time_ns(void);
+
+/**
+ * Gets the kernel statistics for the specified system call
+ * @param syscall - system call identifier
+ * @param stats - pointer to where the statistics will be copied
+ * @return 0 on success, -1 on error
+ */
+int sys_get_stats(int syscall, syscall_stats_t *stats);
+
 /**
  * Gets the current process' id
  * @return process id
@@ -35,12 +65,26 @@ int proc_get_pid(void);
  */
 int proc_get_name(char *name);
 
+/**
+ * Sets the current process' scheduling priority
+ * @param priority - new priority (PROC_PRIORITY_MAX to PROC_PRIORITY_MIN)
+ * @return 0 on success, -1 on error
+ */
+int proc_set_priority(int priority);
+
 /**
  * Puts the current process to sleep for the specified number of seconds
  * @param seconds - number of seconds the process should sleep
  */
 void proc_sleep(int seconds);
 
+/**
+ * Puts the current process to sleep for the specified number of nanoseconds
+ * The duration is rounded up to the timer resolution
+ * @param ns - number of nanoseconds the process should sleep
+ */
+void proc_sleep_ns(unsigned long long ns);
+
 /**
  * Exits the current process
  * @param exitcode An exit code to return to the parent process
@@ -49,6 +93,8 @@ void proc_exit(int exitcode);
 
 /**
  * Writes up to n bytes to the process' specified IO buffer
+ * If PROC_IO_BLOCK is set in io, waits until all n bytes are written;
+ * otherwise returns PROC_IO_EAGAIN if the buffer is full
  * @param io - the IO buffer to write to
  * @param buf - the buffer to copy from
  * @param n - number of bytes to write
@@ -58,6 +104,7 @@ int io_write(int io, char *buf, int n);
 
 /**
  * Reads up to n bytes from the process' specified IO buffer
+ * If PROC_IO_BLOCK is set in io, waits until at least one byte is available
  * @param io - the IO buffer to read from
  * @param buf - the buffer to copy to
  * @param n - number of bytes to read
@@ -72,6 +119,14 @@ int io_read(int io, char *buf, int n);
  */
 int io_flush(int io);
 
+/**
+ * Sets the input mode of the TTY attached to the specified IO buffer
+ * @param io - the IO buffer (must be the TTY input)
+ * @param mode - input mode flags (PROC_IO_MODE_*)
+ * @return -1 on error or 0 on success
+ */
+int io_set_mode(int io, int mode);
+
 /**
  * Allocates a mutex from the kernel
  * @return -1 on error, all other values indicate the mutex id
@@ -10,6 +10,17 @@
 #define PROC_IO_IN      0       // IO Input Id
 #define PROC_IO_OUT     1       // IO Output Id
 
+#define PROC_IO_BLOCK   0x100   // IO flag: block until data/space is available
+
+#define PROC_IO_EAGAIN  -2      // Non-blocking IO could not transfer any data
+
+#define PROC_IO_MODE_LINE   0x1 // TTY input mode: wake readers when a line is complete
+#define PROC_IO_MODE_ECHO   0x2 // TTY input mode: echo input to the TTY output
+
+#define PROC_PRIORITY_MAX       0   // Highest process priority
+#define PROC_PRIORITY_MIN       31  // Lowest process priority
+#define PROC_PRIORITY_DEFAULT   16  // Default process priority
+
 // Syscall identifiers
 typedef enum {
     SYSCALL_NONE,
@@ -29,7 +40,25 @@ typedef enum {
     SYSCALL_SEM_INIT,
     SYSCALL_SEM_DESTROY,
     SYSCALL_SEM_WAIT,
-    SYSCALL_SEM_POST
+    SYSCALL_SEM_POST,
+    SYSCALL_PROC_SET_PRIORITY,
+    SYSCALL_SYS_GET_TIME_NS,
+    SYSCALL_PROC_SLEEP_NS,
+    SYSCALL_SYS_GET_VDSO,
+    SYSCALL_SYS_GET_STATS,
+    SYSCALL_IO_SET_MODE,
+    SYSCALL_MAX                 // Number of system calls (must be last)
 } syscall_t;
 
+#define SYSCALL_NAME_LEN    32  // Maximum system call name length
+
+// System call statistics
+typedef struct syscall_stats_t {
+    char name[SYSCALL_NAME_LEN];    // System call name
+    int args;                       // Number of arguments
+    unsigned int count;             // Number of invocations
+    unsigned long long cycles;      // Cumulative TSC cycles spent in the handler
+    unsigned int avg_cycles;        // Average TSC cycles per invocation
+} syscall_stats_t;
+
 #endif
@@ -12,6 +12,12 @@
 #include "vga.h"
 #include "tty.h"
 #include "kproc.h"
+#include "workqueue.h"
+
+// Work items for the test displays
+work_t test_spinner_work;
+work_t test_timer_work;
+work_t test_proc_list_work;
 
 /**
  * Displays a "spinner" to show activity at the top-right corner of the
@@ -31,7 +37,7 @@ void test_spinner(void) {
  */
 void test_timer(void) {
     vga_set_xy(73, 0);
-    vga_printf("%5d", timer_get_ticks() / 100);
+    vga_printf("%5d", timer_get_ticks() / TIMER_HZ);
 }
 
 /**
@@ -49,7 +55,7 @@ void test_proc_list(void) {
     }
 
     // Periodically clear the screen to handle processes exiting
-    if ((timer_get_ticks() % 100) == 0) {
+    if ((timer_get_ticks() % TIMER_HZ) == 0) {
         for (int r = 1; r < VGA_HEIGHT; r++) {
             for (int c = 0; c < VGA_WIDTH; c++) {
                 vga_putc_at(c, r, bg_color, fg_color, ' ');
@@ -117,14 +123,20 @@ void test_proc_list(void) {
 void test_init(void) {
     kernel_log_info("Initializing test functions");
 
+    // The displays run on the display work queue; they share the VGA
+    // position and read the process table, so they are not preemptible
+
     // Register the spinner to update at a rate of 10 times per second
-    timer_callback_register(&test_spinner, 10, -1);
+    work_init(&test_spinner_work, test_spinner, 0);
+    workqueue_schedule_periodic(WORKQUEUE_DISPLAY, &test_spinner_work, TIMER_HZ / 10);
 
     // Register the timer to update at a rate of 4 times per second
-    timer_callback_register(&test_timer, 25, -1);
+    work_init(&test_timer_work, test_timer, 0);
+    workqueue_schedule_periodic(WORKQUEUE_DISPLAY, &test_timer_work, TIMER_HZ / 4);
 
     // Register the process list to update at a rate of 10 times per second
-    timer_callback_register(&test_proc_list, 10, -1);
+    work_init(&test_proc_list_work, test_proc_list, 0);
+    workqueue_schedule_periodic(WORKQUEUE_DISPLAY, &test_proc_list_work, TIMER_HZ / 10);
 }
 
 #endif
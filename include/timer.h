@@ -11,6 +11,62 @@
 #define TIMERS_MAX 32
 #endif
 
+#ifndef TIMER_HZ
+#define TIMER_HZ 100    // Timer interrupt frequency (ticks per second)
+#endif
+
+#if TIMER_HZ < 50 || TIMER_HZ > 10000
+#error "TIMER_HZ must be between 50 and 10000"
+#endif
+
+// Nanoseconds per timer tick
+#define TIMER_NS_PER_TICK   (1000000000 / TIMER_HZ)
+
+// Fixed-point shift used to convert TSC cycles to nanoseconds
+#define TIMER_TSC_SHIFT     20
+
+// Tickless idle: when only the idle task is runnable, the periodic timer
+// is replaced by a one-shot timer for the next pending event
+#ifndef TIMER_TICKLESS
+#define TIMER_TICKLESS 1
+#endif
+
+// Timer wheel configuration
+// Each level has TIMER_WHEEL_SIZE slots; every level covers TIMER_WHEEL_SIZE
+// times the range of the level below it. Events further in the future than
+// the wheel can represent are clamped to the maximum range.
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SIZE    (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS  4
+#define TIMER_WHEEL_RANGE   (1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+// Timer event
+// Events are linked into a timer wheel slot until they expire or are cancelled
+typedef struct timer_event_t {
+    struct timer_event_t *next;     // Next event in the wheel slot
+    struct timer_event_t **pprev;   // Link pointing to this event (NULL if not pending)
+    int expires;                    // Tick at which the event expires
+    void (*func)(void *data);       // Function to call when the event expires
+    void *data;                     // Data passed to the function
+    int deferrable;                 // Event does not need to wake an idle CPU
+} timer_event_t;
+
+/**
+ * Adds an event to the timer wheel
+ * If the event is already pending it is rescheduled
+ * @param event - pointer to the event (func and data must be set)
+ * @param ticks - number of ticks until the event expires
+ */
+void timer_event_add(timer_event_t *event, int ticks);
+
+/**
+ * Cancels a pending event
+ * Has no effect if the event is not pending
+ * @param event - pointer to the event
+ */
+void timer_event_cancel(timer_event_t *event);
+
 /**
  * Registers a new callback to be called at the specified interval
  * @param func_ptr - function pointer to be called
@@ -29,6 +85,58 @@ int timer_callback_register(void (*func_ptr)(), int interval, int repeat);
  */
 int timer_callback_unregister(int id);
 
+/**
+ * Marks the specified callback as deferrable
+ * Deferrable callbacks do not wake the CPU from tickless idle; they run
+ * on the first tick after the CPU leaves idle
+ * @param id - timer id
+ *
+ * @return 0 on success, -1 on error
+ */
+int timer_callback_set_deferrable(int id);
+
+/**
+ * Enters tickless idle mode if no events are pending in the near future
+ * Should be called when the idle task is scheduled
+ */
+void timer_tickless_enter(void);
+
+/**
+ * Exits tickless idle mode (if active), restoring the periodic timer and
+ * accounting for the ticks that elapsed while idle
+ */
+void timer_tickless_exit(void);
+
+/**
+ * Reads the CPU time stamp counter
+ * @return current time stamp counter value
+ */
+unsigned long long timer_get_tsc(void);
+
+/**
+ * Returns the number of nanoseconds that have elapsed since startup
+ * Backed by the TSC (calibrated against the PIT) when available,
+ * otherwise by the timer tick count
+ * @return monotonic time in nanoseconds
+ */
+unsigned long long timer_get_ns(void);
+
+/**
+ * Divides a 64-bit value by a 32-bit value
+ * Uses a single divl instead of relying on compiler runtime support
+ * @param n - dividend
+ * @param d - divisor
+ * @return quotient, or 0xFFFFFFFF if the quotient does not fit in 32 bits
+ */
+unsigned int timer_div64(unsigned long long n, unsigned int d);
+
+/**
+ * Converts a duration in nanoseconds to timer ticks, rounding up
+ * @param ns - duration in nanoseconds
+ * @return number of ticks
+ */
+int timer_ns_to_ticks(unsigned long long ns);
+
 /**
  * Returns the number of ticks that have occurred since startup
  *
@@ -15,33 +15,63 @@
 #endif
 
 #ifndef TTY_SCROLLBACK
-#define TTY_SCROLLBACK  0   // Number of lines in the scrollback buffer
+#define TTY_SCROLLBACK  50  // Number of lines in the scrollback buffer
 #endif
 
 #define TTY_WIDTH       80  // Width of the TTY
 #define TTY_HEIGHT      25  // Height of the TTY
 
-#define TTY_BUF_SIZE (TTY_WIDTH * (TTY_HEIGHT + TTY_SCROLLBACK))
+// Number of lines in the screen buffer (screen + scrollback)
+#define TTY_LINES       (TTY_HEIGHT + TTY_SCROLLBACK)
+
+#define TTY_BUF_SIZE (TTY_WIDTH * TTY_LINES)
+
+// Dirty row mask covering the entire screen (one bit per row)
+#define TTY_DIRTY_ALL ((1 << TTY_HEIGHT) - 1)
+
+// Maximum number of parameters in an ANSI escape sequence
+#define TTY_ESC_PARAMS  8
+
+// Largest value of an ANSI escape sequence parameter; longer digit strings saturate
+#define TTY_ESC_PARAM_MAX 9999
+
+// ANSI escape sequence parser states
+#define TTY_ESC_NONE    0   // Not in an escape sequence
+#define TTY_ESC_START   1   // Received ESC
+#define TTY_ESC_CSI     2   // Received ESC [ (control sequence)
+
+// Screen buffer cell: VGA attribute in the upper byte, character in the lower byte
+#define TTY_CELL(attr, c) ((unsigned short)(((attr) << 8) | (unsigned char)(c)))
 
 
 // TTY data structure
 // Describes the virtual TTY
 typedef struct tty_t {
     int id;                     // Numerical tty identifier
-    char buf[TTY_BUF_SIZE];     // Screen buffer + scrollback
+    unsigned short buf[TTY_BUF_SIZE]; // Screen buffer + scrollback (circular buffer of lines of VGA cells)
+    int line_top;               // Buffer line shown on the first screen row
+    int line_count;             // Number of scrollback lines available above the screen
 
-    int refresh;                // TTY needs to refresh
+    unsigned int dirty;         // Rows that need to be redrawn (one bit per row)
 
     /* Additional options where supported */
-    int color_bg;               // Background Color
-    int color_fg;               // Foreground Color
+    int color_bg;               // Default Background Color
+    int color_fg;               // Default Foreground Color
+    unsigned char attr;         // Current character attribute (set via ANSI SGR sequences)
+
+    int esc_state;              // ANSI escape sequence parser state
+    int esc_count;              // Index of the escape sequence parameter being parsed
+    int esc_param[TTY_ESC_PARAMS]; // Escape sequence parameters
 
     int pos_x;                  // current x position in the screen
     int pos_y;                  // current y position in the screen
 
-    int pos_scroll;             // Current scrollback position in the buffer
+    int pos_scroll;             // Number of lines scrolled back from the bottom
+
+    int cursor;                 // Screen cursor position last sent to VGA, -1 if none
 
     int echo;                   // If the TTY should echo or not
+    int line_mode;              // Wake blocked readers only when a line is complete
 
     ringbuf_t io_input;         // Input buffer
     ringbuf_t io_output;        // Output buffer
@@ -83,9 +113,27 @@ void tty_input(char c);
 
 /**
  * Updates the TTY with the given character
+ * @param tty - pointer to the TTY
  * @param c - character to update on the TTY screen output
  */
-void tty_update(char c);
+void tty_update(struct tty_t *tty, char c);
+
+/**
+ * Writes characters directly to the TTY screen output
+ * @param tty - pointer to the TTY
+ * @param buf - characters to write
+ * @param n - number of characters to write
+ * @return number of characters written
+ */
+int tty_write(struct tty_t *tty, char *buf, int n);
+
+/**
+ * Returns a line of the TTY screen buffer
+ * @param tty - pointer to the TTY
+ * @param row - screen row (negative rows are in the scrollback buffer)
+ * @return pointer to the first cell of the line
+ */
+unsigned short *tty_line(struct tty_t *tty, int row);
 
 /**
  * Scrolls the TTY up one line into the scrollback buffer
@@ -0,0 +1,109 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Shared Kernel Data Page (vDSO)
+ *
+ * The kernel publishes frequently requested data (time, OS name) in a
+ * page that user code reads directly instead of making a system call.
+ * Readers use a sequence lock: the kernel increments the sequence number
+ * before and after each update, so an odd value (or a value that changed
+ * during the read) means the data must be read again.
+ */
+#ifndef VDSO_H
+#define VDSO_H
+
+#define VDSO_PAGE_SIZE      4096
+#define VDSO_NAME_LEN       32
+
+// Shared data published by the kernel
+typedef struct vdso_data_t {
+    volatile unsigned int seq;      // Sequence number (odd while updating)
+    volatile int ticks;             // Timer ticks since startup
+    int hz;                         // Timer ticks per second
+    unsigned int ns_per_tick;       // Nanoseconds per timer tick
+    unsigned long long tsc_base;    // TSC value at time zero
+    unsigned int tsc_mult;          // TSC to nanosecond multiplier (0 if the TSC is unusable)
+    unsigned int tsc_shift;         // TSC to nanosecond shift
+    char os_name[VDSO_NAME_LEN];    // Operating system name
+    int sysenter;                   // System calls may use SYSENTER
+} vdso_data_t;
+
+/**
+ * Reads the CPU time stamp counter
+ * @return current time stamp counter value
+ */
+static inline unsigned long long vdso_rdtsc(void) {
+    unsigned long long tsc;
+    asm volatile("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+/**
+ * Converts TSC cycles to nanoseconds
+ * Each half is multiplied separately to keep the 64x32-bit product in range
+ * @param tsc - number of cycles
+ * @param mult - fixed-point multiplier
+ * @param shift - fixed-point shift
+ * @return number of nanoseconds
+ */
+static inline unsigned long long vdso_tsc_to_ns(unsigned long long tsc, unsigned int mult, unsigned int shift) {
+    unsigned int hi = tsc >> 32;
+    unsigned int lo = tsc;
+
+    return (((unsigned long long)hi * mult) << (32 - shift))
+        + (((unsigned long long)lo * mult) >> shift);
+}
+
+/**
+ * Begins a read of the shared data
+ * @param vdso - shared data page
+ * @return sequence number to pass to vdso_read_retry
+ */
+static inline unsigned int vdso_read_begin(vdso_data_t *vdso) {
+    unsigned int seq;
+
+    // Wait for any update in progress to complete
+    while ((seq = vdso->seq) & 1);
+
+    asm volatile("" ::: "memory");
+    return seq;
+}
+
+/**
+ * Determines if a read of the shared data must be retried
+ * @param vdso - shared data page
+ * @param seq - sequence number from vdso_read_begin
+ * @return non-zero if the data changed while it was being read
+ */
+static inline int vdso_read_retry(vdso_data_t *vdso, unsigned int seq) {
+    asm volatile("" ::: "memory");
+    return vdso->seq != seq;
+}
+
+/**
+ * Initializes the shared data page
+ */
+void vdso_init(void);
+
+/**
+ * Returns the shared data page
+ * @return pointer to the shared data page
+ */
+vdso_data_t *vdso_get(void);
+
+/**
+ * Publishes the current timer tick count
+ * @param ticks - timer ticks since startup
+ */
+void vdso_update_ticks(int ticks);
+
+/**
+ * Publishes the TSC calibration
+ * @param base - TSC value at time zero
+ * @param mult - TSC to nanosecond multiplier (0 if the TSC is unusable)
+ * @param shift - TSC to nanosecond shift
+ */
+void vdso_update_tsc(unsigned long long base, unsigned int mult, unsigned int shift);
+
+#endif
@@ -17,6 +17,10 @@
 #define VGA_WIDTH               80
 #define VGA_HEIGHT              25
 
+#ifndef VGA_FLUSH_HZ
+#define VGA_FLUSH_HZ            50  // Number of times per second the display is updated
+#endif
+
 #define VGA_COLOR_BLACK         0x0
 #define VGA_COLOR_BLUE          0x1
 #define VGA_COLOR_GREEN         0x2
@@ -58,6 +62,14 @@ void vga_init(void);
  */
 void vga_clear(void);
 
+/**
+ * Copies the changed spans of the shadow framebuffer to VGA memory
+ * Runs once per frame on the display work queue; all other output
+ * functions only update the shadow framebuffer
+ * Must be called with interrupts disabled
+ */
+void vga_flush(void);
+
 /**
  * Sets the current X/Y (column/row) position
  *
@@ -182,8 +194,22 @@ void vga_cursor_enable(void);
  */
 void vga_cursor_disable(void);
 
+/**
+ * Moves the cursor to the specified position if the cursor is enabled
+ * Does not change the "current" x/y position
+ *
+ * @param x - x position (0 to VGA_WIDTH-1)
+ * @param y - y position (0 to VGA_HEIGHT-1)
+ */
+void vga_cursor_move(int x, int y);
+
 /**
  * Refresh the VGA for the given TTY
+ *
+ * Writes each dirty row of the TTY to the shadow framebuffer and then
+ * moves the cursor once
+ *
+ * @param tty - pointer to the TTY
  */
 void vga_tty_refresh(tty_t *tty);
 
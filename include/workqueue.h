@@ -0,0 +1,88 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Kernel Work Queues
+ */
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "kproc.h"
+#include "timer.h"
+
+#ifndef WORKQUEUE_MAX
+#define WORKQUEUE_MAX       4   // Maximum number of work queues
+#endif
+
+// Predefined work queues
+#define WORKQUEUE_HIGH      0   // Latency sensitive work (input handling)
+#define WORKQUEUE_DISPLAY   1   // Screen updates
+
+// Work flags
+#define WORK_PREEMPTIBLE    0x1 // Runs with interrupts enabled (kernel calls and state shared
+                                // with the kernel need interrupts disabled)
+
+// Work item
+// Describes a function to be run by a work queue's worker process
+typedef struct work_t {
+    struct work_t *next;        // Next work item in the queue
+    void (*func)(void);         // Function to run
+    int flags;                  // Work flags
+    int pending;                // Work is queued and has not started running
+
+    int queue;                  // Work queue used for periodic work
+    int interval;               // Interval (in ticks) for periodic work
+    timer_event_t event;        // Timer event for periodic work
+} work_t;
+
+// Work queue
+typedef struct workqueue_t {
+    int allocated;              // Indicates that this work queue has been allocated
+    work_t *head;               // First pending work item
+    work_t *tail;               // Last pending work item
+    int sem;                    // Semaphore counting the pending work items
+    proc_t *worker;             // Worker process
+} workqueue_t;
+
+/**
+ * Initializes the work queues and creates the predefined work queues
+ */
+void workqueue_init(void);
+
+/**
+ * Creates a work queue and its worker process
+ * @param name - name of the worker process
+ * @param priority - scheduling priority of the worker process
+ * @return work queue id, -1 on error
+ */
+int workqueue_create(char *name, int priority);
+
+/**
+ * Initializes a work item
+ * @param work - pointer to the work item
+ * @param func - function to run
+ * @param flags - work flags
+ */
+void work_init(work_t *work, void (*func)(void), int flags);
+
+/**
+ * Queues a work item to be run by a work queue
+ * Has no effect if the work item is already pending
+ * Must be called from the kernel (interrupts disabled)
+ * @param id - work queue id
+ * @param work - pointer to the work item
+ * @return 0 on success, -1 on error
+ */
+int workqueue_schedule(int id, work_t *work);
+
+/**
+ * Queues a work item at a regular interval
+ * Periodic work does not wake the CPU from tickless idle
+ * @param id - work queue id
+ * @param work - pointer to the work item
+ * @param interval - number of ticks between runs
+ * @return 0 on success, -1 on error
+ */
+int workqueue_schedule_periodic(int id, work_t *work, int interval);
+
+#endif
@@ -59,3 +59,21 @@ int bit_clear(int value, int bit) {
 int bit_toggle(int value, int bit) {
     return (value ^ (1 << bit));
 }
+
+/**
+ * Finds the first (least significant) bit that is set
+ * @param value - the integer value to search
+ * @return index of the first set bit, -1 if no bits are set
+ */
+int bit_find_first(int value) {
+    int bit;
+
+    if (value == 0) {
+        return -1;
+    }
+
+    // Bit scan forward finds the index in a single instruction
+    asm("bsfl %1, %0" : "=r"(bit) : "rm"(value));
+
+    return bit;
+}
@@ -45,8 +45,9 @@ void interrupts_enable(void) {
  * Disable interrupts with the CPU
  */
 void interrupts_disable(void) {
-    kernel_log_trace("interrupts: disabling");
+    // Logged once disabled so the kernel remains the only log producer
     asm("cli");
+    kernel_log_trace("interrupts: disabling");
 }
 
 /**
@@ -11,6 +11,7 @@
 
 #include "interrupts.h"
 #include "kernel.h"
+#include "klog.h"
 #include "scheduler.h"
 #include "trapframe.h"
 #include "vga.h"
@@ -25,6 +26,11 @@ proc_t *active_proc = NULL;
 // Current log level
 int kernel_log_level = KERNEL_LOG_LEVEL_DEFAULT;
 
+// Current log level of each subsystem
+int kernel_log_levels[KERNEL_LOG_SUBSYS_MAX] = {
+    [0 ... KERNEL_LOG_SUBSYS_MAX - 1] = KERNEL_LOG_LEVEL_DEFAULT
+};
+
 /**
  * Initializes any kernel internal data structures and variables
  */
@@ -36,121 +42,20 @@ void kernel_init(void) {
 }
 
 /**
- * Prints a kernel log message to the host with an error log level
- *
- * @param msg - string format for the message to be displayed
- * @param ... - variable arguments to pass in to the string format
- */
-void kernel_log_error(char *msg, ...) {
-    // Return if our log level is less than error
-    if (kernel_log_level < KERNEL_LOG_LEVEL_ERROR) {
-        return;
-    }
-
-    va_list args;
-
-    printf("error: ");
-
-    va_start(args, msg);
-    vprintf(msg, args);
-    va_end(args);
-
-    printf("\n");
-}
-
-/**
- * Prints a kernel log message to the host with a warning log level
+ * Prints a kernel log message to the host
+ * Called through the kernel_log_* macros, which check the log level
  *
+ * @param level - log level of the message
  * @param msg - string format for the message to be displayed
  * @param ... - variable arguments to pass in to the string format
  */
-void kernel_log_warn(char *msg, ...) {
-    // Return if our log level is less than warn
-    if (kernel_log_level < KERNEL_LOG_LEVEL_WARN) {
-        return;
-    }
-
+void kernel_log_write(int level, char *msg, ...) {
     va_list args;
 
-    printf("warn: ");
-
+    // Record the message; it is formatted and printed by the log drain process
     va_start(args, msg);
-    vprintf(msg, args);
+    klog_write(level, msg, args);
     va_end(args);
-
-    printf("\n");
-}
-
-/**
- * Prints a kernel log message to the host with an info log level
- *
- * @param msg - string format for the message to be displayed
- * @param ... - variable arguments to pass in to the string format
- */
-void kernel_log_info(char *msg, ...) {
-    // Return if our log level is less than info
-    if (kernel_log_level < KERNEL_LOG_LEVEL_INFO) {
-        return;
-    }
-
-    // Obtain the list of variable arguments
-    va_list args;
-
-    // Indicate this is an 'info' type of message
-    printf("info: ");
-
-    // Pass the message variable arguments to vprintf
-    va_start(args, msg);
-    vprintf(msg, args);
-    va_end(args);
-
-    printf("\n");
-}
-
-/**
- * Prints a kernel log message to the host with a debug log level
- *
- * @param msg - string format for the message to be displayed
- * @param ... - variable arguments to pass in to the string format
- */
-void kernel_log_debug(char *msg, ...) {
-    // Return if our log level is less than debug
-    if (kernel_log_level < KERNEL_LOG_LEVEL_DEBUG) {
-        return;
-    }
-
-    va_list args;
-
-    printf("debug: ");
-
-    va_start(args, msg);
-    vprintf(msg, args);
-    va_end(args);
-
-    printf("\n");
-}
-
-/**
- * Prints a kernel log message to the host with a trace log level
- *
- * @param msg - string format for the message to be displayed
- * @param ... - variable arguments to pass in to the string format
- */
-void kernel_log_trace(char *msg, ...) {
-    // Return if our log level is less than trace
-    if (kernel_log_level < KERNEL_LOG_LEVEL_TRACE) {
-        return;
-    }
-
-    va_list args;
-
-    printf("trace: ");
-
-    va_start(args, msg);
-    vprintf(msg, args);
-    va_end(args);
-
-    printf("\n");
 }
 
 /**
@@ -165,6 +70,9 @@ void kernel_log_trace(char *msg, ...) {
 void kernel_panic(char *msg, ...) {
     va_list args;
 
+    // Print any pending log messages leading up to the panic
+    klog_flush();
+
     printf("panic: ");
 
     va_start(args, msg);
@@ -186,7 +94,7 @@ int kernel_get_log_level(void) {
 }
 
 /**
- * Sets the new log level and returns the value set
+ * Sets the new log level of all subsystems and returns the value set
  * @param level - the log level to set
  * @return the kernel log level
  */
@@ -199,15 +107,46 @@ int kernel_set_log_level(int level) {
         kernel_log_level = level;
     }
 
+    for (int i = 0; i < KERNEL_LOG_SUBSYS_MAX; i++) {
+        kernel_log_levels[i] = kernel_log_level;
+    }
+
     kernel_log_info("kernel log level set to %d", kernel_log_level);
 
     return kernel_log_level;
 }
 
+/**
+ * Sets the log level of a single subsystem
+ * @param subsys - the subsystem
+ * @param level - the log level to set
+ * @return the subsystem log level, -1 on error
+ */
+int kernel_set_subsys_log_level(int subsys, int level) {
+    if (subsys < 0 || subsys >= KERNEL_LOG_SUBSYS_MAX) {
+        return -1;
+    }
+
+    if (level < KERNEL_LOG_LEVEL_NONE) {
+        level = KERNEL_LOG_LEVEL_NONE;
+    } else if (level > KERNEL_LOG_LEVEL_ALL) {
+        level = KERNEL_LOG_LEVEL_ALL;
+    }
+
+    kernel_log_levels[subsys] = level;
+
+    kernel_log_info("subsystem %d log level set to %d", subsys, level);
+
+    return level;
+}
+
 /**
  * Exits the kernel
  */
 void kernel_exit(void) {
+    // Print any pending log messages
+    klog_flush();
+
     // Print to the terminal
     printf("Exiting %s...\n", OS_NAME);
 
@@ -218,6 +157,7 @@ void kernel_exit(void) {
     vga_printf("%*s", 80, "");
     vga_set_xy(0, 0);
     vga_printf("Exiting %s...\n", OS_NAME);
+    vga_flush();
 
     // Exit
     exit(0);
@@ -236,8 +176,11 @@ void kernel_context_enter(trapframe_t *trapframe) {
     // Process the interrupt that occurred
     interrupts_irq_handler(trapframe->interrupt);
 
-    // Run the scheduler
-    scheduler_run();
+    // Run the scheduler only if the active process blocked, exited, used
+    // its time slice or was outranked; otherwise return directly to it
+    if (scheduler_preempt_pending()) {
+        scheduler_run();
+    }
 
     if (!active_proc) {
         kernel_panic("No active process!");
@@ -1,3 +1,6 @@
+// Log messages from this file belong to the keyboard subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_KEYBOARD
+
 #include <spede/flames.h>
 #include <spede/stdio.h>
 #include <spede/machine/io.h>
@@ -7,6 +10,7 @@
 #include "keyboard.h"
 #include "kproc.h"
 #include "tty.h"
+#include "workqueue.h"
 
 // Keyboard data port
 #define KBD_PORT_DATA           0x60
@@ -14,6 +18,15 @@
 // Keyboard status port
 #define KBD_PORT_STAT           0x64
 
+// Number of scancodes that can wait to be decoded (must be a power of two)
+#ifndef KBD_SCANCODE_MAX
+#define KBD_SCANCODE_MAX        128
+#endif
+
+#if (KBD_SCANCODE_MAX & (KBD_SCANCODE_MAX - 1)) != 0
+#error "KBD_SCANCODE_MAX must be a power of two"
+#endif
+
 // Keyboard status bits (CTRL, ALT, SHIFT, CAPS, NUMLOCK)
 #define KEY_STATUS_CTRL         0x01
 #define KEY_STATUS_ALT          0x02
@@ -58,6 +71,23 @@
 static unsigned int kbd_status = 0x0;
 static unsigned int esc_status = 0;
 
+// Raw scancode received by the interrupt handler
+typedef struct kbd_scancode_t {
+    unsigned char scancode;     // Scancode read from the keyboard
+    int pid;                    // User process interrupted by the keystroke (-1 if none)
+} kbd_scancode_t;
+
+// Scancodes waiting to be decoded; only accessed with interrupts disabled
+static kbd_scancode_t kbd_scancodes[KBD_SCANCODE_MAX];
+static unsigned int kbd_scancode_head;
+static unsigned int kbd_scancode_tail;
+
+// Work item that decodes the scancodes
+static work_t kbd_work;
+
+// User process interrupted by the scancode being decoded (Ctrl+Q target)
+static int kbd_target_pid = -1;
+
 // Primary keymap
 static const char keyboard_map_primary[] = {
     KEY_NULL,           /* 0x00 - Null */
@@ -262,17 +292,62 @@ void kernel_context_enter(trapframe_t *trapframe) {
 }
 */
 
-/*
- *
+/**
+ * Keyboard interrupt handler
+ * Only queues the raw scancodes; decoding is deferred to a work queue
  */
 void keyboard_irq_handler(void) {
-    unsigned int c = keyboard_poll();
+    int pid = -1;
+    unsigned char scancode;
 
-    if (c) {
-        tty_input(c);//was tty_update (c) for phase 3
+    // Remember which process was running when the key was pressed
+    if (active_proc && active_proc->type == PROC_TYPE_USER) {
+        pid = active_proc->pid;
+    }
+
+    while ((inportb(KBD_PORT_STAT) & 0x1) != 0) {
+        scancode = keyboard_scan();
+
+        // Scancodes are dropped if the buffer is full
+        if (kbd_scancode_tail - kbd_scancode_head < KBD_SCANCODE_MAX) {
+            kbd_scancodes[kbd_scancode_tail & (KBD_SCANCODE_MAX - 1)].scancode = scancode;
+            kbd_scancodes[kbd_scancode_tail & (KBD_SCANCODE_MAX - 1)].pid = pid;
+            kbd_scancode_tail++;
+        }
     }
+
+    workqueue_schedule(WORKQUEUE_HIGH, &kbd_work);
 }
 
+/**
+ * Keyboard work
+ * Decodes one queued scancode and performs the resulting TTY input or
+ * kernel command; requeues itself while scancodes remain so interrupts
+ * are serviced in between
+ */
+void keyboard_work(void) {
+    kbd_scancode_t *entry;
+    unsigned int c;
+
+    if (kbd_scancode_head == kbd_scancode_tail) {
+        return;
+    }
+
+    entry = &kbd_scancodes[kbd_scancode_head & (KBD_SCANCODE_MAX - 1)];
+    kbd_scancode_head++;
+
+    kbd_target_pid = entry->pid;
+    c = keyboard_decode(entry->scancode);
+    kbd_target_pid = -1;
+
+    if (c) {
+        tty_input(c);
+    }
+
+    if (kbd_scancode_head != kbd_scancode_tail) {
+        workqueue_schedule(WORKQUEUE_HIGH, &kbd_work);
+    }
+}
 
 /**
  * Initializes keyboard data structures and variables
@@ -283,6 +358,12 @@ void keyboard_init() {
     // No status keys pressed by default
     kbd_status = 0x0;
 
+    kbd_scancode_head = 0;
+    kbd_scancode_tail = 0;
+
+    // Keyboard input is decoded on the high priority work queue
+    work_init(&kbd_work, keyboard_work, 0);
+
     // Register the keyboard ISR
     interrupts_irq_register(IRQ_KEYBOARD, isr_entry_keyboard, keyboard_irq_handler);
 }
@@ -471,7 +552,12 @@ unsigned int keyboard_decode(unsigned int c) {
                 }
 
                 if (c == 'q' || c == 'Q') {
-                    kproc_destroy(active_proc);
+                    // Destroy the process that was interrupted, not the worker
+                    proc_t *proc = pid_to_proc(kbd_target_pid);
+
+                    if (proc) {
+                        kproc_destroy(proc);
+                    }
                     return KEY_NULL;
                 }
 
@@ -479,6 +565,37 @@ unsigned int keyboard_decode(unsigned int c) {
                     breakpoint();
                     return KEY_NULL;
                 }
+
+                // Scrollback
+                switch (c) {
+                    case KEY_UP:
+                        tty_scroll_up();
+                        return KEY_NULL;
+
+                    case KEY_DOWN:
+                        tty_scroll_down();
+                        return KEY_NULL;
+
+                    case KEY_PAGE_UP:
+                        for (int i = 0; i < TTY_HEIGHT - 1; i++) {
+                            tty_scroll_up();
+                        }
+                        return KEY_NULL;
+
+                    case KEY_PAGE_DOWN:
+                        for (int i = 0; i < TTY_HEIGHT - 1; i++) {
+                            tty_scroll_down();
+                        }
+                        return KEY_NULL;
+
+                    case KEY_HOME:
+                        tty_scroll_top();
+                        return KEY_NULL;
+
+                    case KEY_END:
+                        tty_scroll_bottom();
+                        return KEY_NULL;
+                }
             }
 
             if (c) {
@@ -0,0 +1,275 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Kernel Log Buffer
+ *
+ * Log messages are recorded unformatted (format pointer and raw
+ * arguments) into a single-producer/single-consumer ring so logging from
+ * the kernel only costs a few stores. The kernel (interrupts disabled) is
+ * the only producer; the log drain process (or a flush on panic/exit) is
+ * the consumer and does the formatting and host output.
+ */
+
+#include <spede/stdbool.h>
+#include <spede/stdio.h>
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "klog.h"
+#include "kproc.h"
+#include "ksem.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "timer.h"
+
+// Number of ticks between checks for records to drain
+#define KLOG_DRAIN_TICKS    ((KLOG_DRAIN_MS * TIMER_HZ + 999) / 1000)
+
+// Log record buffer
+klog_record_t klog_buf[KLOG_SIZE];
+
+// Next record to be drained (owned by the consumer)
+unsigned int klog_head;
+
+// Next record to be written (owned by the producer)
+unsigned int klog_tail;
+
+// Number of messages dropped because the log buffer was full
+unsigned int klog_dropped;
+
+// Semaphore the log drain process waits on
+int klog_sem = -1;
+
+// The log drain process has been woken and has not started draining
+int klog_woken;
+
+// Log level prefixes
+static char *klog_level_name[] = {
+    "none", "error", "warn", "info", "debug", "trace", "all"
+};
+
+/**
+ * Loads an index owned by the other side of the buffer
+ */
+#define klog_load(index)            __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+
+/**
+ * Publishes an index owned by this side of the buffer
+ */
+#define klog_store(index, value)    __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
+/**
+ * Indicates if the character is a printf flag, width, precision or
+ * length modifier character
+ * @param c - character
+ * @return true if the character is part of a conversion specification
+ */
+static bool klog_is_modifier(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == ' ' || c == '#'
+        || c == '.' || c == '*' || c == 'l' || c == 'h' || c == 'z';
+}
+
+/**
+ * Stores the arguments referenced by the message format in a log record
+ * String arguments are copied since they may change before the record
+ * is drained
+ * @param rec - pointer to the log record
+ * @param args - message arguments
+ * @return 0 on success, -1 if the format uses too many arguments
+ */
+static int klog_capture(klog_record_t *rec, va_list args) {
+    int str = 0;
+    char *p = rec->fmt;
+    char *s;
+    int n;
+
+    rec->nargs = 0;
+    rec->strings = 0;
+
+    while (*p) {
+        if (*p++ != '%') {
+            continue;
+        }
+
+        // Skip the flags, width, precision and length (* takes an argument)
+        for (; klog_is_modifier(*p); p++) {
+            if (*p == '*') {
+                if (rec->nargs == KLOG_ARGS) {
+                    return -1;
+                }
+
+                rec->args[rec->nargs++] = va_arg(args, unsigned int);
+            }
+        }
+
+        if (*p == '\0') {
+            break;
+        }
+
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+
+        if (rec->nargs == KLOG_ARGS) {
+            return -1;
+        }
+
+        if (*p == 's') {
+            s = va_arg(args, char *);
+
+            if (!s) {
+                s = "(null)";
+            }
+
+            // Truncate strings that do not fit (the last byte is always the terminator)
+            n = strlen(s);
+            if (n > KLOG_STR_SIZE - 1 - str) {
+                n = KLOG_STR_SIZE - 1 - str;
+            }
+
+            memcpy(&rec->str[str], s, n);
+            rec->str[str + n] = '\0';
+
+            rec->args[rec->nargs] = str;
+            rec->strings |= 1 << rec->nargs;
+
+            str += n;
+            if (str < KLOG_STR_SIZE - 1) {
+                str++;
+            }
+        } else {
+            rec->args[rec->nargs] = va_arg(args, unsigned int);
+        }
+
+        rec->nargs++;
+        p++;
+    }
+
+    return 0;
+}
+
+/**
+ * Adds a log message to the log buffer
+ * The message is dropped if the log buffer is full
+ * @param level - log level
+ * @param fmt - message format (must remain valid until drained)
+ * @param args - message arguments
+ */
+void klog_write(int level, char *fmt, va_list args) {
+    unsigned int tail = klog_tail;
+    klog_record_t *rec;
+
+    if (tail - klog_load(klog_head) >= KLOG_SIZE) {
+        klog_dropped++;
+        return;
+    }
+
+    rec = &klog_buf[tail & KLOG_MASK];
+    rec->ticks = timer_get_ticks();
+    rec->level = level;
+    rec->fmt = fmt;
+
+    if (klog_capture(rec, args) != 0) {
+        // Log the format itself rather than reading past the arguments
+        rec->fmt = "(too many log arguments) %s";
+        rec->nargs = 1;
+        rec->strings = 0;
+        rec->args[0] = (unsigned int)fmt;
+    }
+
+    klog_store(klog_tail, tail + 1);
+}
+
+/**
+ * Formats and prints all messages in the log buffer to the host
+ * @return number of messages printed
+ */
+int klog_flush(void) {
+    unsigned int head = klog_head;
+    unsigned int dropped;
+    klog_record_t rec;
+    unsigned int a[KLOG_ARGS] = {0};
+    int count = 0;
+
+    while (head != klog_load(klog_tail)) {
+        // Copy the record so the slot can be reused while printing
+        memcpy(&rec, &klog_buf[head & KLOG_MASK], sizeof(rec));
+        klog_store(klog_head, ++head);
+
+        for (int i = 0; i < KLOG_ARGS; i++) {
+            a[i] = (rec.strings & (1 << i)) ? (unsigned int)&rec.str[rec.args[i]] : rec.args[i];
+        }
+
+        printf("%s: [%u] ", klog_level_name[rec.level], rec.ticks);
+        printf(rec.fmt, a[0], a[1], a[2], a[3], a[4], a[5]);
+        printf("\n");
+
+        count++;
+    }
+
+    dropped = __atomic_exchange_n(&klog_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        printf("warn: %u log messages dropped\n", dropped);
+    }
+
+    return count;
+}
+
+/**
+ * Log drain process
+ * Prints the contents of the log buffer at the lowest priority so logging
+ * does not delay interrupt handling; blocks while the buffer is empty
+ */
+void klog_proc(void) {
+    while (1) {
+        // Blocks until the drain timer finds records in the log buffer
+        sem_wait(klog_sem);
+        klog_woken = 0;
+
+        klog_flush();
+    }
+}
+
+/**
+ * Log drain timer callback
+ * Wakes the log drain process if records are waiting to be drained
+ * The process is not woken from klog_write since it may be called in
+ * the middle of scheduler or semaphore operations
+ */
+static void klog_timer(void) {
+    if (!klog_woken && klog_tail != klog_load(klog_head)) {
+        klog_woken = 1;
+        ksem_post(klog_sem);
+    }
+}
+
+/**
+ * Initializes the log drain
+ * Creates the log drain process and the timer callback that wakes it
+ */
+void klog_init(void) {
+    int pid;
+
+    kernel_log_info("Initializing the kernel log drain");
+
+    klog_sem = ksem_init(0);
+    if (klog_sem < 0) {
+        kernel_panic("Unable to allocate the log drain semaphore");
+    }
+
+    // Create the log drain process; it only runs when nothing else is ready
+    pid = kproc_create(klog_proc, "klog", PROC_TYPE_KERNEL);
+    if (pid < 0) {
+        kernel_panic("Unable to create the log drain process");
+    }
+
+    scheduler_set_priority(pid_to_proc(pid), PROC_PRIORITY_MIN);
+
+    kernel_log_info("Created log drain process %d", pid);
+
+    // Records are only written while the CPU is awake, so the check does
+    // not need to wake the CPU from tickless idle
+    timer_callback_set_deferrable(timer_callback_register(klog_timer, KLOG_DRAIN_TICKS, -1));
+}
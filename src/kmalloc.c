@@ -0,0 +1,303 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Kernel Heap Allocator
+ *
+ * The heap is divided into pages. Pages are handed out by a page
+ * allocator (freed pages first, then never used pages) and carved into
+ * slabs of equally sized objects, one set of slabs per power of two size
+ * class. Freed objects are kept on their class' free list, so both
+ * allocating and freeing are constant time.
+ *
+ * Freed page runs are reused whole or split, but adjacent free runs are
+ * never merged, so large allocations fragment the heap over time.
+ */
+
+// Log messages from this file belong to the kmalloc subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_KMALLOC
+
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "kmalloc.h"
+
+// Maximum page run length that is kept on its own free list
+// Longer runs share a single free list
+#define KPAGE_RUNS 8
+
+// Free list entry (stored in the free memory itself)
+typedef struct kmalloc_free_t {
+    struct kmalloc_free_t *next;
+} kmalloc_free_t;
+
+// Free page run (stored in the first free page)
+typedef struct kpage_run_t {
+    struct kpage_run_t *next;
+    int pages;
+} kpage_run_t;
+
+// Kernel heap
+unsigned char kmalloc_heap[KMALLOC_HEAP_SIZE] __attribute__((aligned(KMALLOC_PAGE_SIZE)));
+
+// Owner of each heap page:
+//   >= 0 - size class of the slab the page belongs to
+//   < 0  - first page of a large allocation of -n pages
+int kmalloc_page_info[KMALLOC_PAGES];
+
+// Next page that has never been allocated
+int kpage_next;
+
+// Freed page runs, indexed by run length (index 0 holds the runs longer
+// than KPAGE_RUNS)
+kpage_run_t *kpage_free_list[KPAGE_RUNS + 1];
+
+// Free objects of each size class
+kmalloc_free_t *kmalloc_free_list[KMALLOC_CLASSES];
+
+// Size class statistics (followed by the large allocation statistics)
+kmalloc_stats_t kmalloc_stats[KMALLOC_CLASSES + 1];
+
+/**
+ * Allocates contiguous pages from the kernel heap
+ * @param pages - number of pages
+ * @return pointer to the first page, NULL on error
+ */
+void *kpage_alloc(int pages) {
+    kpage_run_t **prev;
+    kpage_run_t *run = NULL;
+
+    if (pages < 1) {
+        return NULL;
+    }
+
+    // Reuse a freed run of the same length, or split the shortest longer run
+    for (int n = pages; n <= KPAGE_RUNS && !run; n++) {
+        if (kpage_free_list[n]) {
+            run = kpage_free_list[n];
+            kpage_free_list[n] = run->next;
+        }
+    }
+
+    // Then the first long run that is large enough
+    for (prev = &kpage_free_list[0]; *prev && !run; prev = &(*prev)->next) {
+        if ((*prev)->pages >= pages) {
+            run = *prev;
+            *prev = run->next;
+            break;
+        }
+    }
+
+    if (run) {
+        // Return the unused end of the run
+        kpage_free((unsigned char *)run + pages * KMALLOC_PAGE_SIZE, run->pages - pages);
+        return run;
+    }
+
+    if (pages > KMALLOC_PAGES - kpage_next) {
+        kernel_log_warn("kmalloc: out of memory allocating %d pages", pages);
+        return NULL;
+    }
+
+    run = (kpage_run_t *)&kmalloc_heap[kpage_next * KMALLOC_PAGE_SIZE];
+    kpage_next += pages;
+
+    return run;
+}
+
+/**
+ * Frees pages allocated by kpage_alloc
+ * @param ptr - pointer to the first page
+ * @param pages - number of pages
+ */
+void kpage_free(void *ptr, int pages) {
+    kpage_run_t *run = ptr;
+    int n = (pages <= KPAGE_RUNS) ? pages : 0;
+
+    if (!ptr || pages < 1) {
+        return;
+    }
+
+    run->pages = pages;
+    run->next = kpage_free_list[n];
+    kpage_free_list[n] = run;
+}
+
+/**
+ * Returns the heap page that contains the given address
+ * @param ptr - address within the heap
+ * @return page index, -1 if the address is not in the heap
+ */
+static int kmalloc_page(void *ptr) {
+    unsigned char *p = ptr;
+
+    if (p < &kmalloc_heap[0] || p >= &kmalloc_heap[KMALLOC_HEAP_SIZE]) {
+        return -1;
+    }
+
+    return (p - kmalloc_heap) / KMALLOC_PAGE_SIZE;
+}
+
+/**
+ * Adds a slab to a size class
+ * @param class - size class
+ * @return 0 on success, -1 if no pages are available
+ */
+static int kmalloc_grow(int class) {
+    kmalloc_stats_t *stats = &kmalloc_stats[class];
+    int pages = (stats->size > KMALLOC_PAGE_SIZE) ? stats->size / KMALLOC_PAGE_SIZE : 1;
+    int count = pages * KMALLOC_PAGE_SIZE / stats->size;
+    unsigned char *slab = kpage_alloc(pages);
+    kmalloc_free_t *obj;
+    int page;
+
+    if (!slab) {
+        return -1;
+    }
+
+    page = kmalloc_page(slab);
+
+    for (int i = 0; i < pages; i++) {
+        kmalloc_page_info[page + i] = class;
+    }
+
+    // Carve the slab into objects
+    for (int i = count - 1; i >= 0; i--) {
+        obj = (kmalloc_free_t *)(slab + i * stats->size);
+        obj->next = kmalloc_free_list[class];
+        kmalloc_free_list[class] = obj;
+    }
+
+    stats->slabs++;
+    stats->objects += count;
+    stats->pages += pages;
+
+    return 0;
+}
+
+/**
+ * Allocates memory from the kernel heap
+ * Requests are rounded up to a power of two size class; requests larger
+ * than the largest class are allocated whole pages
+ * @param size - number of bytes to allocate
+ * @return pointer to the allocated memory, NULL on error
+ */
+void *kmalloc(size_t size) {
+    kmalloc_free_t *obj;
+    int class = 0;
+    int pages;
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (size > (1U << KMALLOC_MAX_SHIFT)) {
+        pages = (size + KMALLOC_PAGE_SIZE - 1) / KMALLOC_PAGE_SIZE;
+        obj = kpage_alloc(pages);
+
+        if (!obj) {
+            kmalloc_stats[KMALLOC_CLASS_LARGE].failures++;
+            return NULL;
+        }
+
+        kmalloc_page_info[kmalloc_page(obj)] = -pages;
+
+        kmalloc_stats[KMALLOC_CLASS_LARGE].allocs++;
+        kmalloc_stats[KMALLOC_CLASS_LARGE].in_use++;
+        kmalloc_stats[KMALLOC_CLASS_LARGE].pages += pages;
+
+        return obj;
+    }
+
+    while (size > (1U << (class + KMALLOC_MIN_SHIFT))) {
+        class++;
+    }
+
+    if (!kmalloc_free_list[class] && kmalloc_grow(class) != 0) {
+        kmalloc_stats[class].failures++;
+        return NULL;
+    }
+
+    obj = kmalloc_free_list[class];
+    kmalloc_free_list[class] = obj->next;
+
+    kmalloc_stats[class].allocs++;
+    kmalloc_stats[class].in_use++;
+
+    return obj;
+}
+
+/**
+ * Frees memory allocated by kmalloc
+ * @param ptr - pointer to the memory (NULL is ignored)
+ */
+void kfree(void *ptr) {
+    kmalloc_free_t *obj = ptr;
+    int pages;
+    int page;
+    int info;
+
+    if (!ptr) {
+        return;
+    }
+
+    page = kmalloc_page(ptr);
+    if (page < 0 || page >= kpage_next) {
+        kernel_panic("kfree: invalid pointer 0x%08x", (unsigned int)ptr);
+        return;
+    }
+
+    info = kmalloc_page_info[page];
+
+    if (info < 0) {
+        pages = -info;
+
+        kmalloc_page_info[page] = 0;
+        kpage_free(ptr, pages);
+
+        kmalloc_stats[KMALLOC_CLASS_LARGE].frees++;
+        kmalloc_stats[KMALLOC_CLASS_LARGE].in_use--;
+        kmalloc_stats[KMALLOC_CLASS_LARGE].pages -= pages;
+        return;
+    }
+
+    obj->next = kmalloc_free_list[info];
+    kmalloc_free_list[info] = obj;
+
+    kmalloc_stats[info].frees++;
+    kmalloc_stats[info].in_use--;
+}
+
+/**
+ * Returns the statistics for a size class
+ * @param class - size class (0 to KMALLOC_CLASSES-1, or KMALLOC_CLASS_LARGE)
+ * @param stats - pointer to the statistics to fill in
+ * @return 0 on success, -1 on error
+ */
+int kmalloc_get_stats(int class, kmalloc_stats_t *stats) {
+    if (class < 0 || class > KMALLOC_CLASS_LARGE || !stats) {
+        return -1;
+    }
+
+    memcpy(stats, &kmalloc_stats[class], sizeof(kmalloc_stats_t));
+
+    return 0;
+}
+
+/**
+ * Initializes the kernel heap
+ */
+void kmalloc_init(void) {
+    kernel_log_info("Initializing kernel heap (%d pages)", KMALLOC_PAGES);
+
+    kpage_next = 0;
+
+    memset(kmalloc_page_info, 0, sizeof(kmalloc_page_info));
+    memset(kpage_free_list, 0, sizeof(kpage_free_list));
+    memset(kmalloc_free_list, 0, sizeof(kmalloc_free_list));
+    memset(kmalloc_stats, 0, sizeof(kmalloc_stats));
+
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_stats[i].size = 1 << (i + KMALLOC_MIN_SHIFT);
+    }
+}
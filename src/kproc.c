@@ -5,11 +5,15 @@
  * Kernel Process Handling
  */
 
+// Log messages from this file belong to the kproc subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_KPROC
+
 #include <spede/stdio.h>
 #include <spede/string.h>
 #include <spede/machine/proc_reg.h>
 
 #include "kernel.h"
+#include "kmalloc.h"
 #include "trapframe.h"
 #include "kproc.h"
 #include "scheduler.h"
@@ -19,8 +23,11 @@
 #include "prog_user.h"
 #include "syscall_common.h"
 
-// Next available process id to be assigned
-int next_pid;
+// Generation counter for each process table entry
+// Process ids encode the table entry and the entry's generation:
+//   pid = generation * PROC_MAX + entry
+// so lookups are constant time and stale process ids are detected
+int proc_generation[PROC_MAX];
 
 // Process table allocator
 queue_t proc_allocator;
@@ -28,22 +35,30 @@ queue_t proc_allocator;
 // Process table
 proc_t proc_table[PROC_MAX];
 
-// Process stacks
-unsigned char proc_stack[PROC_MAX][PROC_STACK_SIZE];
+#if QUEUE_SIZE < PROC_MAX
+#error "QUEUE_SIZE must be at least PROC_MAX"
+#endif
 
 /**
  * Looks up a process in the process table via the process id
  * @param pid - process id
- * @return pointer to the pruocess entry, NULL or error or if not found
+ * @return pointer to the process entry, NULL or error or if not found
  */
 proc_t *pid_to_proc(int pid) {
-    for (unsigned int i = 0; i < PROC_MAX; i++) {
-        if (proc_table[i].pid == pid) {
-            return &proc_table[i];
-        }
+    proc_t *proc;
+
+    if (pid < 0) {
+        return NULL;
     }
 
-    return NULL;
+    proc = &proc_table[pid % PROC_MAX];
+
+    // The entry may have been recycled for a newer process
+    if (proc->state == NONE || proc->pid != pid) {
+        return NULL;
+    }
+
+    return proc;
 }
 
 /**
@@ -52,17 +67,11 @@ proc_t *pid_to_proc(int pid) {
  * @return the index into the process table, -1 on error
  */
 int proc_to_entry(proc_t *proc) {
-    if (proc == NULL) {
+    if (proc < &proc_table[0] || proc >= &proc_table[PROC_MAX]) {
         return -1;
     }
 
-    for (unsigned int i = 0; i < PROC_MAX; i++) {
-        if (proc->pid == proc_table[i].pid) {
-            return i;
-        }
-    }
-
-    return -1;
+    return proc - proc_table;
 }
 
 /**
@@ -108,14 +117,22 @@ int kproc_create(void *proc_ptr, char *proc_name, proc_type_t proc_type) {
     // Initialize the PCB entry for the process
     memset(proc, 0, sizeof(proc_t));
 
-    // Point the stack to the process stack
-    proc->stack = proc_stack[proc_entry];
+    // Allocate the process stack
+    proc->stack = kmalloc(PROC_STACK_SIZE);
+
+    if (!proc->stack) {
+        kernel_log_warn("Unable to allocate a process stack");
+        queue_in(&proc_allocator, proc_entry);
+        return -1;
+    }
 
     // Set the process state to RUNNING
     // Initialize other process control block variables to default values
-    proc->pid         = next_pid++;
+    proc->pid         = proc_generation[proc_entry] * PROC_MAX + proc_entry;
     proc->state       = IDLE;
     proc->type        = proc_type;
+    proc->priority    = PROC_PRIORITY_DEFAULT;
+    proc->base_priority = PROC_PRIORITY_DEFAULT;
     proc->run_time    = 0;
     proc->cpu_time    = 0;
     proc->start_time  = timer_get_ticks();
@@ -142,6 +159,12 @@ int kproc_create(void *proc_ptr, char *proc_name, proc_type_t proc_type) {
     proc->trapframe->fs = get_fs();
     proc->trapframe->gs = get_gs();
 
+    // The idle task only runs when nothing else is ready
+    if (proc->pid == 0) {
+        proc->priority = PROC_PRIORITY_MIN;
+        proc->base_priority = PROC_PRIORITY_MIN;
+    }
+
     // Add the process to the run queue
     scheduler_add(proc);
 
@@ -178,12 +201,15 @@ int kproc_destroy(proc_t *proc) {
 
     kernel_log_info("Destroying process %s (%d) entry=%d", proc->name, proc->pid, entry);
 
-    // Reset the process stack
-    memset(proc->stack, 0, PROC_STACK_SIZE);
+    // Free the process stack
+    kfree(proc->stack);
 
     // Reset the process control block
     memset(proc, 0, sizeof(proc_t));
 
+    // Invalidate any remaining references to the process id
+    proc_generation[entry]++;
+
     // Add the entry back to the process queue (to be recycled)
     if (queue_in(&proc_allocator, entry) != 0) {
         kernel_log_warn("Unable to queue entry back into allocator");
@@ -227,6 +253,7 @@ int kproc_attach_tty(int pid, int tty_number) {
         kernel_log_debug("Attaching PID %d to TTY id %d", proc->pid, tty_number);
         proc->io[PROC_IO_IN] = &tty->io_input;
         proc->io[PROC_IO_OUT] = &tty->io_output;
+        proc->tty = tty;
         return 0;
     }
 
@@ -253,9 +280,7 @@ void kproc_init(void) {
 
     // Initialize the process table
     memset(&proc_table, 0, sizeof(proc_table));
-
-    // Initialize the process stacks
-    memset(proc_stack, 0, sizeof(proc_stack));
+    memset(proc_generation, 0, sizeof(proc_generation));
 
     // Create/execute the idle process (kproc_idle)
     pid = kproc_create(kproc_idle, "idle", PROC_TYPE_KERNEL);
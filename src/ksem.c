@@ -19,9 +19,6 @@ sem_t semaphores[SEM_MAX];
 // semaphore ids to be allocated
 queue_t sem_queue;
 
-// Process table
-extern proc_t proc_table[PROC_MAX];
-
 /**
  * Initializes kernel semaphore data structures
  * @return -1 on error, 0 on success
@@ -158,8 +155,8 @@ int ksem_post(int id) {
             return -1;
         }
         // Check if pid is a valid process ID
-        if (pid >= 0 && pid < PROC_MAX && proc_table[pid].state != NONE) {
-            proc_t *proc = &proc_table[pid];
+        proc_t *proc = pid_to_proc(pid);
+        if (proc) {
             scheduler_add(proc);
             semaphores[id].count--;
         } else {
@@ -4,9 +4,13 @@
  *
  * Kernel System Call Handlers
  */
+// Log messages from this file belong to the syscall subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_SYSCALL
+
 #include <spede/time.h>
 #include <spede/string.h>
 #include <spede/stdio.h>
+#include <spede/machine/proc_reg.h>
 
 #include "kernel.h"
 #include "kproc.h"
@@ -16,6 +20,158 @@
 #include "timer.h"
 #include "ksem.h"
 #include "kmutex.h"
+#include "vdso.h"
+#include "tty.h"
+#include "trapframe.h"
+
+// SYSENTER model specific registers
+#define MSR_SYSENTER_CS     0x174
+#define MSR_SYSENTER_ESP    0x175
+#define MSR_SYSENTER_EIP    0x176
+
+// Kernel stack (see context.S)
+extern char kstack[];
+
+// System call handler
+// Every handler takes the three argument registers; each kernel handler is
+// called through a thunk that converts the registers to its parameter types
+typedef int (*ksyscall_handler_t)(unsigned int arg1, unsigned int arg2, unsigned int arg3);
+
+// System call table entry
+typedef struct ksyscall_entry_t {
+    ksyscall_handler_t handler;     // Handler function
+    int args;                       // Number of arguments used by the handler
+    char *name;                     // System call name
+    unsigned int count;             // Number of invocations
+    unsigned long long cycles;      // Cumulative TSC cycles spent in the handler
+} ksyscall_entry_t;
+
+/**
+ * Defines the thunk for a handler with no arguments
+ */
+#define KSYSCALL_THUNK0(func) \
+    static int func##_thunk(unsigned int arg1, unsigned int arg2, unsigned int arg3) { \
+        return func(); \
+    }
+
+/**
+ * Defines the thunk for a handler with one argument
+ */
+#define KSYSCALL_THUNK1(func, type1) \
+    static int func##_thunk(unsigned int arg1, unsigned int arg2, unsigned int arg3) { \
+        return func((type1)arg1); \
+    }
+
+/**
+ * Defines the thunk for a handler with two arguments
+ */
+#define KSYSCALL_THUNK2(func, type1, type2) \
+    static int func##_thunk(unsigned int arg1, unsigned int arg2, unsigned int arg3) { \
+        return func((type1)arg1, (type2)arg2); \
+    }
+
+/**
+ * Defines the thunk for a handler with three arguments
+ */
+#define KSYSCALL_THUNK3(func, type1, type2, type3) \
+    static int func##_thunk(unsigned int arg1, unsigned int arg2, unsigned int arg3) { \
+        return func((type1)arg1, (type2)arg2, (type3)arg3); \
+    }
+
+KSYSCALL_THUNK3(ksyscall_io_read,           int, char *, int)
+KSYSCALL_THUNK3(ksyscall_io_write,          int, char *, int)
+KSYSCALL_THUNK1(ksyscall_io_flush,          int)
+KSYSCALL_THUNK2(ksyscall_io_set_mode,       int, int)
+KSYSCALL_THUNK0(ksyscall_sys_get_time)
+KSYSCALL_THUNK1(ksyscall_sys_get_name,      char *)
+KSYSCALL_THUNK1(ksyscall_proc_sleep,        int)
+KSYSCALL_THUNK0(ksyscall_proc_exit)
+KSYSCALL_THUNK0(ksyscall_proc_get_pid)
+KSYSCALL_THUNK1(ksyscall_proc_get_name,     char *)
+KSYSCALL_THUNK0(ksyscall_mutex_init)
+KSYSCALL_THUNK1(ksyscall_mutex_destroy,     int)
+KSYSCALL_THUNK1(ksyscall_mutex_lock,        int)
+KSYSCALL_THUNK1(ksyscall_mutex_unlock,      int)
+KSYSCALL_THUNK1(ksyscall_sem_init,          int)
+KSYSCALL_THUNK1(ksyscall_sem_destroy,       int)
+KSYSCALL_THUNK1(ksyscall_sem_wait,          int)
+KSYSCALL_THUNK1(ksyscall_sem_post,          int)
+KSYSCALL_THUNK1(ksyscall_proc_set_priority, int)
+KSYSCALL_THUNK1(ksyscall_sys_get_time_ns,   unsigned long long *)
+KSYSCALL_THUNK0(ksyscall_sys_get_vdso)
+KSYSCALL_THUNK2(ksyscall_sys_get_stats,     int, syscall_stats_t *)
+
+/**
+ * Puts the active process to sleep for a duration passed in two registers
+ * @param lo - low 32 bits of the duration in nanoseconds
+ * @param hi - high 32 bits of the duration in nanoseconds
+ * @param unused - unused argument register
+ */
+static int ksyscall_proc_sleep_ns_thunk(unsigned int lo, unsigned int hi, unsigned int unused) {
+    return ksyscall_proc_sleep_ns(((unsigned long long)hi << 32) | lo);
+}
+
+#define KSYSCALL_ENTRY(id, func, nargs) \
+    [id] = { .handler = func##_thunk, .args = (nargs), .name = #id }
+
+// System call table, indexed by system call identifier
+ksyscall_entry_t ksyscall_table[SYSCALL_MAX] = {
+    KSYSCALL_ENTRY(SYSCALL_IO_READ,             ksyscall_io_read,               3),
+    KSYSCALL_ENTRY(SYSCALL_IO_WRITE,            ksyscall_io_write,              3),
+    KSYSCALL_ENTRY(SYSCALL_IO_FLUSH,            ksyscall_io_flush,              1),
+    KSYSCALL_ENTRY(SYSCALL_SYS_GET_TIME,        ksyscall_sys_get_time,          0),
+    KSYSCALL_ENTRY(SYSCALL_SYS_GET_NAME,        ksyscall_sys_get_name,          1),
+    KSYSCALL_ENTRY(SYSCALL_PROC_SLEEP,          ksyscall_proc_sleep,            1),
+    KSYSCALL_ENTRY(SYSCALL_PROC_EXIT,           ksyscall_proc_exit,             0),
+    KSYSCALL_ENTRY(SYSCALL_PROC_GET_PID,        ksyscall_proc_get_pid,          0),
+    KSYSCALL_ENTRY(SYSCALL_PROC_GET_NAME,       ksyscall_proc_get_name,         1),
+    KSYSCALL_ENTRY(SYSCALL_MUTEX_INIT,          ksyscall_mutex_init,            0),
+    KSYSCALL_ENTRY(SYSCALL_MUTEX_DESTROY,       ksyscall_mutex_destroy,         1),
+    KSYSCALL_ENTRY(SYSCALL_MUTEX_LOCK,          ksyscall_mutex_lock,            1),
+    KSYSCALL_ENTRY(SYSCALL_MUTEX_UNLOCK,        ksyscall_mutex_unlock,          1),
+    KSYSCALL_ENTRY(SYSCALL_SEM_INIT,            ksyscall_sem_init,              1),
+    KSYSCALL_ENTRY(SYSCALL_SEM_DESTROY,         ksyscall_sem_destroy,           1),
+    KSYSCALL_ENTRY(SYSCALL_SEM_WAIT,            ksyscall_sem_wait,              1),
+    KSYSCALL_ENTRY(SYSCALL_SEM_POST,            ksyscall_sem_post,              1),
+    KSYSCALL_ENTRY(SYSCALL_PROC_SET_PRIORITY,   ksyscall_proc_set_priority,     1),
+    KSYSCALL_ENTRY(SYSCALL_SYS_GET_TIME_NS,     ksyscall_sys_get_time_ns,       1),
+    KSYSCALL_ENTRY(SYSCALL_PROC_SLEEP_NS,       ksyscall_proc_sleep_ns,         2),
+    KSYSCALL_ENTRY(SYSCALL_SYS_GET_VDSO,        ksyscall_sys_get_vdso,          0),
+    KSYSCALL_ENTRY(SYSCALL_SYS_GET_STATS,       ksyscall_sys_get_stats,         2),
+    KSYSCALL_ENTRY(SYSCALL_IO_SET_MODE,         ksyscall_io_set_mode,           2),
+};
+
+/**
+ * Dispatches a system call to its handler
+ * @param syscall - system call identifier
+ * @param arg1 - first argument
+ * @param arg2 - second argument
+ * @param arg3 - third argument
+ * @return return value of the system call, -1 if the system call is invalid
+ */
+int ksyscall_dispatch(unsigned int syscall, unsigned int arg1, unsigned int arg2, unsigned int arg3) {
+    ksyscall_entry_t *entry;
+    unsigned long long start;
+    int rc;
+
+    // Look up the handler in the system call table
+    if (syscall >= SYSCALL_MAX || !ksyscall_table[syscall].handler) {
+        kernel_log_error("Invalid system call %d from pid %d", syscall, active_proc->pid);
+        return -1;
+    }
+
+    entry = &ksyscall_table[syscall];
+
+    kernel_log_trace("syscall %s (%d args) from pid %d", entry->name, entry->args, active_proc->pid);
+
+    // Dispatch to the handler, recording the time spent in it
+    start = timer_get_tsc();
+    rc = entry->handler(arg1, arg2, arg3);
+    entry->cycles += timer_get_tsc() - start;
+    entry->count++;
+
+    return rc;
+}
 
 /**
  * System call IRQ handler
@@ -25,15 +181,10 @@ void ksyscall_irq_handler(void) {
     // Default return value
     int rc = -1;
 
-    // System call number
-    int syscall;
-
-    // Arguments
-    unsigned int arg1;
-    unsigned int arg2;
-    unsigned int arg3;
+    // Process making the system call (it may block or exit)
+    proc_t *proc = active_proc;
 
-    if (!active_proc) {
+    if (!proc) {
         kernel_panic("Invalid process");
     }
 
@@ -44,90 +195,113 @@ void ksyscall_irq_handler(void) {
     // Get data from the trapframe registers
     // System call identifier is stored on the EAX register
     // Additional arguments should be stored on additional registers (ebx, ecx, etc.)
-    syscall = active_proc->trapframe->eax;
-    arg1 = active_proc->trapframe->ebx;
-    arg2 = active_proc->trapframe->ecx;
-    arg3 = active_proc->trapframe->edx;
-
-    // Dispatch to the appropriate function
-    // Cast parameters as necessary
-    switch (syscall) {
-        case SYSCALL_IO_WRITE:
-            rc = ksyscall_io_write((int)arg1, (char *)arg2, (int)arg3);
-            break;
-
-        case SYSCALL_IO_READ:
-            rc = ksyscall_io_read((int)arg1, (char *)arg2, (int)arg3);
-            break;
-
-        case SYSCALL_IO_FLUSH:
-            rc = ksyscall_io_flush((int)arg1);
-            break;
-
-        case SYSCALL_SYS_GET_TIME:
-            rc = ksyscall_sys_get_time();
-            break;
+    rc = ksyscall_dispatch(active_proc->trapframe->eax,
+                           active_proc->trapframe->ebx,
+                           active_proc->trapframe->ecx,
+                           active_proc->trapframe->edx);
 
-        case SYSCALL_SYS_GET_NAME:
-            rc = ksyscall_sys_get_name((char *)arg1);
-            break;
-
-        case SYSCALL_PROC_SLEEP:
-            rc = ksyscall_proc_sleep((int)arg1);
-            break;
+    // Ensure that the EAX register contains a return value (if appropriate)
+    // A process that blocked receives it when it is resumed
+    if (proc->state != NONE) {
+        proc->trapframe->eax = (unsigned int)rc;
+    }
+}
 
-        case SYSCALL_PROC_EXIT:
-            rc = ksyscall_proc_exit();
-            break;
+/**
+ * SYSENTER system call handler
+ * Dispatches the system call and returns if the caller can be resumed
+ * directly; otherwise saves the caller's state and runs the scheduler
+ * @param frame - registers saved by the SYSENTER entry
+ */
+void ksyscall_sysenter_handler(ksyscall_frame_t *frame) {
+    proc_t *proc = active_proc;
+    trapframe_t *trapframe;
+    int rc;
 
-        case SYSCALL_PROC_GET_PID:
-            rc = ksyscall_proc_get_pid();
-            break;
+    if (!proc) {
+        kernel_panic("Invalid process");
+    }
 
-        case SYSCALL_PROC_GET_NAME:
-            rc = ksyscall_proc_get_name((char *)arg1);
-            break;
+    rc = ksyscall_dispatch(frame->eax, frame->ebx, frame->ecx, frame->edx);
 
-        case SYSCALL_MUTEX_INIT:
-            rc = ksyscall_mutex_init();
-            break;
+    // Fast path: the caller is still running and nothing needs to preempt it
+    if (active_proc == proc && !scheduler_preempt_pending()) {
+        frame->eax = (unsigned int)rc;
+        return;
+    }
 
-        case SYSCALL_MUTEX_DESTROY:
-            rc = ksyscall_mutex_destroy(arg1);
-            break;
+    // Slow path: build an interrupt trapframe on the caller's stack so that
+    // it can be resumed like any other process; the trapframe ends where
+    // the caller's EFLAGS were pushed so iret pops them
+    if (proc->state != NONE) {
+        trapframe = (trapframe_t *)(frame->ebp + sizeof(unsigned int) - sizeof(trapframe_t));
+
+        trapframe->gs = get_gs();
+        trapframe->fs = get_fs();
+        trapframe->es = get_es();
+        trapframe->ds = get_ds();
+        trapframe->edi = frame->edi;
+        trapframe->esi = frame->esi;
+        trapframe->ebp = frame->ebp;
+        trapframe->ebx = frame->ebx;
+        trapframe->edx = frame->edx;
+        trapframe->ecx = frame->ecx;
+        trapframe->eax = (unsigned int)rc;
+        trapframe->interrupt = IRQ_SYSCALL;
+        trapframe->eip = frame->esi;
+        trapframe->cs = get_cs();
+        trapframe->eflags = frame->eflags;
+
+        proc->trapframe = trapframe;
+    }
 
-        case SYSCALL_MUTEX_LOCK:
-            rc = ksyscall_mutex_lock(arg1);
-            break;
+    // Run the scheduler
+    scheduler_run();
 
-        case SYSCALL_MUTEX_UNLOCK:
-            rc = ksyscall_mutex_unlock(arg1);
-            break;
+    if (!active_proc) {
+        kernel_panic("No active process!");
+    }
 
-        case SYSCALL_SEM_INIT:
-            rc = ksyscall_sem_init(arg1);
-            break;
+    // Exit the kernel context
+    kernel_context_exit(active_proc->trapframe);
+}
 
-        case SYSCALL_SEM_DESTROY:
-            rc = ksyscall_sem_destroy(arg1);
-            break;
+/**
+ * Writes a model specific register
+ * @param msr - register number
+ * @param value - value to write
+ */
+void ksyscall_wrmsr(unsigned int msr, unsigned int value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
 
-        case SYSCALL_SEM_POST:
-            rc = ksyscall_sem_post(arg1);
-            break;
+/**
+ * Initializes the SYSENTER system call entry if the CPU supports it
+ */
+void ksyscall_sysenter_init(void) {
+#if KSYSCALL_SYSENTER
+    unsigned int eax = 1;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+
+    // CPUID leaf 1, EDX bit 11 indicates SYSENTER/SYSEXIT support
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+    if (!(edx & (1 << 11))) {
+        kernel_log_info("SYSENTER not supported; using int $0x80 for system calls");
+        return;
+    }
 
-        case SYSCALL_SEM_WAIT:
-            rc = ksyscall_sem_wait(arg1);
-            break;
+    ksyscall_wrmsr(MSR_SYSENTER_CS, KCODE_SEG);
+    ksyscall_wrmsr(MSR_SYSENTER_ESP, (unsigned int)&kstack[KSTACK_SIZE]);
+    ksyscall_wrmsr(MSR_SYSENTER_EIP, (unsigned int)isr_entry_sysenter);
 
-        default:
-            kernel_panic("Invalid system call %d!", syscall);
-    }
+    // Let user code know that the fast entry is available
+    vdso_get()->sysenter = 1;
 
-    // Ensure that the EAX register contains a return value (if appropriate)
-    if (active_proc) {
-        active_proc->trapframe->eax = (unsigned int)rc;
-    }
+    kernel_log_info("SYSENTER system call entry enabled");
+#endif
 }
 
 /**
@@ -136,25 +310,36 @@ void ksyscall_irq_handler(void) {
 void ksyscall_init(void) {
     // Register the IDT entry and IRQ handler for the syscall IRQ (IRQ_SYSCALL)
     interrupts_irq_register(IRQ_SYSCALL, isr_entry_syscall, ksyscall_irq_handler);
+
+    // Enable the fast system call entry
+    ksyscall_sysenter_init();
 }
 
 /**
  * Writes up to n bytes to the process' specified IO buffer
+ * If the buffer is full, returns PROC_IO_EAGAIN, or if PROC_IO_BLOCK is set
+ * in io, waits until space is freed and returns 0
  * @param io - the IO buffer to write to
  * @param buf - the buffer to copy from
  * @param n - number of bytes to write
  * @return -1 on error or value indicating number of bytes copied
  */
 int ksyscall_io_write(int io, char *buf, int size) {
+    bool block = (io & PROC_IO_BLOCK) != 0;
+    struct tty_t *tty;
+    int rc;
+
     if (!active_proc) {
         return -1;
     }
 
-    if (!active_proc) {
+    io &= ~PROC_IO_BLOCK;
+
+    if (io < 0 || io >= PROC_IO_MAX) {
         return -1;
     }
 
-    if (io < 0 || io >= PROC_IO_MAX) {
+    if (!buf || size < 0) {
         return -1;
     }
 
@@ -162,7 +347,27 @@ int ksyscall_io_write(int io, char *buf, int size) {
         return -1;
     }
 
-    return ringbuf_write_mem(active_proc->io[io], buf, size);
+    // Write TTY output straight into the TTY screen so each byte is copied
+    // once; buffered output must be displayed first to preserve ordering
+    tty = active_proc->tty;
+    if (tty && active_proc->io[io] == &tty->io_output
+        && ringbuf_is_empty(&tty->io_output)) {
+        return tty_write(tty, buf, size);
+    }
+
+    rc = ringbuf_write_mem(active_proc->io[io], buf, size);
+
+    // The buffer is full: wait for the consumer to free space (the caller
+    // retries once it runs again) or tell the caller to try again later
+    if (rc == 0 && size > 0) {
+        if (!block) {
+            return PROC_IO_EAGAIN;
+        }
+
+        scheduler_wait(active_proc, &active_proc->io[io]->writers);
+    }
+
+    return rc;
 }
 
 /**
@@ -173,10 +378,15 @@ int ksyscall_io_write(int io, char *buf, int size) {
  * @return -1 on error or value indicating number of bytes copied
  */
 int ksyscall_io_read(int io, char *buf, int size) {
+    bool block = (io & PROC_IO_BLOCK) != 0;
+    int rc;
+
     if (!active_proc) {
         return -1;
     }
 
+    io &= ~PROC_IO_BLOCK;
+
     if (io < 0 || io >= PROC_IO_MAX) {
         return -1;
     }
@@ -185,8 +395,20 @@ int ksyscall_io_read(int io, char *buf, int size) {
         return -1;
     }
 
-    return ringbuf_read_mem(active_proc->io[io], buf, size);
+    rc = ringbuf_read_mem(active_proc->io[io], buf, size);
+
+    // Space was freed for blocked writers
+    if (rc > 0) {
+        scheduler_wake(&active_proc->io[io]->writers);
+    }
 
+    // Nothing to read: wait until the producer wakes us; the caller
+    // retries the read once it runs again
+    if (rc == 0 && size > 0 && block) {
+        scheduler_wait(active_proc, &active_proc->io[io]->readers);
+    }
+
+    return rc;
 }
 
 /**
@@ -212,12 +434,51 @@ int ksyscall_io_flush(int io) {
     return 0;
 }
 
+/**
+ * Sets the input mode of the TTY attached to the specified IO buffer
+ * @param io - the IO buffer (must be the TTY input)
+ * @param mode - input mode flags (PROC_IO_MODE_*)
+ * @return -1 on error or 0 on success
+ */
+int ksyscall_io_set_mode(int io, int mode) {
+    struct tty_t *tty;
+
+    if (!active_proc || !active_proc->tty) {
+        return -1;
+    }
+
+    tty = active_proc->tty;
+
+    if (io < 0 || io >= PROC_IO_MAX || active_proc->io[io] != &tty->io_input) {
+        return -1;
+    }
+
+    tty->line_mode = (mode & PROC_IO_MODE_LINE) != 0;
+    tty->echo = (mode & PROC_IO_MODE_ECHO) != 0;
+
+    return 0;
+}
+
 /**
  * Gets the current system time (in seconds)
  * @return system time in seconds
  */
 int ksyscall_sys_get_time(void) {
-    return timer_get_ticks() / 100;
+    return timer_get_ticks() / TIMER_HZ;
+}
+
+/**
+ * Gets the current monotonic system time in nanoseconds
+ * @param ns - pointer to where the time will be stored
+ * @return 0 on success, -1 on error
+ */
+int ksyscall_sys_get_time_ns(unsigned long long *ns) {
+    if (!ns) {
+        return -1;
+    }
+
+    *ns = timer_get_ns();
+    return 0;
 }
 
 /**
@@ -234,12 +495,62 @@ int ksyscall_sys_get_name(char *name) {
     return 0;
 }
 
+/**
+ * Gets the address of the shared kernel data page
+ * @return address of the shared data page
+ */
+int ksyscall_sys_get_vdso(void) {
+    return (int)vdso_get();
+}
+
+/**
+ * Gets the statistics for the specified system call
+ * @param syscall - system call identifier
+ * @param stats - pointer to where the statistics will be copied
+ * @return 0 on success, -1 on error
+ */
+int ksyscall_sys_get_stats(int syscall, syscall_stats_t *stats) {
+    ksyscall_entry_t *entry;
+
+    if (syscall < 0 || syscall >= SYSCALL_MAX || !stats) {
+        return -1;
+    }
+
+    entry = &ksyscall_table[syscall];
+
+    memset(stats, 0, sizeof(syscall_stats_t));
+
+    if (entry->name) {
+        strncpy(stats->name, entry->name, SYSCALL_NAME_LEN - 1);
+    }
+
+    stats->args = entry->args;
+    stats->count = entry->count;
+    stats->cycles = entry->cycles;
+
+    if (entry->count) {
+        stats->avg_cycles = timer_div64(entry->cycles, entry->count);
+    }
+
+    return 0;
+}
+
 /**
  * Puts the active process to sleep for the specified number of seconds
  * @param seconds - number of seconds the process should sleep
  */
 int ksyscall_proc_sleep(int seconds) {
-    scheduler_sleep(active_proc, seconds * 100);
+    scheduler_sleep(active_proc, seconds * TIMER_HZ);
+    return 0;
+}
+
+/**
+ * Puts the active process to sleep for the specified number of nanoseconds
+ * The duration is rounded up to the timer resolution
+ * @param ns - number of nanoseconds the process should sleep
+ */
+int ksyscall_proc_sleep_ns(unsigned long long ns) {
+    scheduler_sleep(active_proc, timer_ns_to_ticks(ns));
     return 0;
 }
 
@@ -276,6 +587,19 @@ int ksyscall_proc_get_name(char *name) {
     return 0;
 }
 
+/**
+ * Sets the active process' scheduling priority
+ * @param priority - new priority (PROC_PRIORITY_MAX to PROC_PRIORITY_MIN)
+ * @return 0 on success, -1 on error
+ */
+int ksyscall_proc_set_priority(int priority) {
+    if (!active_proc) {
+        return -1;
+    }
+
+    return scheduler_set_priority(active_proc, priority);
+}
+
 /**
  * Allocates a mutex from the kernel
  * @return -1 on error, all other values indicate the mutex id
@@ -9,6 +9,7 @@
 #include "interrupts.h"
 #include "kernel.h"
 #include "keyboard.h"
+#include "klog.h"
 #include "timer.h"
 #include "tty.h"
 #include "vga.h"
@@ -16,8 +17,11 @@
 #include "kproc.h"
 #include "ksyscall.h"
 #include "test.h"
+#include "kmalloc.h"
 #include "kmutex.h"
 #include "ksem.h"
+#include "vdso.h"
+#include "workqueue.h"
 
 int main(void) {
     // Always iniialize the kernel
@@ -26,17 +30,14 @@ int main(void) {
     // Initialize interrupts
     interrupts_init();
 
+    // Initialize the shared data page (updated by the timer)
+    vdso_init();
+
     // Initialize timers
     timer_init();
 
-    // Initialize the TTY
-    tty_init();
-
-    // Initialize the VGA driver
-    vga_init();
-
-    // Initialize the keyboard driver
-    keyboard_init();
+    // Initialize the kernel heap
+    kmalloc_init();
 
     // Initialize the scheduler
     scheduler_init();
@@ -53,6 +54,21 @@ int main(void) {
     // Initialize kernel mutexes
     kmutexes_init();
 
+    // Initialize the log drain (creates the log drain process)
+    klog_init();
+
+    // Initialize work queues (creates the worker processes)
+    workqueue_init();
+
+    // Initialize the TTY
+    tty_init();
+
+    // Initialize the VGA driver
+    vga_init();
+
+    // Initialize the keyboard driver
+    keyboard_init();
+
     // Test initialization
     test_init();
 
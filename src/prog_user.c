@@ -15,7 +15,7 @@
     char __pprint_buf[512] = {0}; \
     int i = snprintf(__pprint_buf, sizeof(__pprint_buf), (fmt), ##__VA_ARGS__); \
     if (i > 0) { \
-        io_write(PROC_IO_OUT, __pprint_buf, i); \
+        io_write(PROC_IO_OUT | PROC_IO_BLOCK, __pprint_buf, i); \
     } \
 }
 
@@ -24,6 +24,10 @@
 #define CMD_SLEEP "sleep"
 #define CMD_TIME "time"
 #define CMD_LOCK "lock"
+#define CMD_STATS "stats"
+#define CMD_BENCH "bench"
+
+#define BENCH_ITERATIONS 1000
 
 /*
  * Mutexes for the lock
@@ -63,6 +67,9 @@ void prog_shell(void) {
     io_flush(PROC_IO_IN);
     io_flush(PROC_IO_OUT);
 
+    // Read whole lines; the TTY echoes what is typed
+    io_set_mode(PROC_IO_IN, PROC_IO_MODE_LINE | PROC_IO_MODE_ECHO);
+
     pprintf("%s %s (process id %d) is running!\n", os_name, name, pid);
     pprintf("Sleeping for %d seconds at time %d ... ", sleep_seconds, sys_get_time());
 
@@ -77,16 +84,16 @@ void prog_shell(void) {
 
         reading = 1;
         while (reading) {
+            // Wait for input without holding the lock
+            buflen = io_read(PROC_IO_IN | PROC_IO_BLOCK, buf, BUF_SIZE);
+
             mutex_lock(shell_mutex[pid % 2]);
-            buflen = io_read(PROC_IO_IN, buf, BUF_SIZE);
 
             for (int i = 0; i < buflen; i++) {
                 if (buf[i] == '\n' || buf[i] == 0) {
-                    io_write(PROC_IO_OUT, &buf[i], 1);
                     reading = 0;
-                } else if ( buf[i] != 0) {
+                } else if (input_len < (int)sizeof(input) - 1) {
                     input[input_len++] = buf[i];
-                    io_write(PROC_IO_OUT, &buf[i], 1);
                 }
             }
             mutex_unlock(shell_mutex[pid % 2]);
@@ -98,6 +105,8 @@ void prog_shell(void) {
                 pprintf("\texit\t  exits the process\n");
                 pprintf("\tlock\t  takes a lock that may block other shells\n");
                 pprintf("\tsleep\t  puts the process to sleep for %d seconds\n", sleep_seconds);
+                pprintf("\tstats\t  displays system call statistics\n");
+                pprintf("\tbench\t  measures the system call round trip cost\n");
                 pprintf("\ttime\t  displays the current system time\n");
                 pprintf("\n");
             } else if(strncmp(input, CMD_SLEEP, strlen(CMD_SLEEP)) == 0) {
@@ -106,6 +115,18 @@ void prog_shell(void) {
                 pprintf("... and awake at time %d!\n", sys_get_time());
             } else if (strncmp(input, CMD_TIME, strlen(CMD_TIME)) == 0) {
                 pprintf("The current time is %d seconds\n", sys_get_time());
+            } else if (strncmp(input, CMD_STATS, strlen(CMD_STATS)) == 0) {
+                syscall_stats_t stats;
+
+                pprintf("%-32s %10s %10s\n", "System Call", "Count", "Avg Cycles");
+                for (int i = 0; i < SYSCALL_MAX; i++) {
+                    if (sys_get_stats(i, &stats) == 0 && stats.count) {
+                        pprintf("%-32s %10u %10u\n", stats.name, stats.count, stats.avg_cycles);
+                    }
+                }
+            } else if (strncmp(input, CMD_BENCH, strlen(CMD_BENCH)) == 0) {
+                pprintf("int $0x80: %d cycles per call\n", sys_bench(0, BENCH_ITERATIONS));
+                pprintf("sysenter:  %d cycles per call\n", sys_bench(1, BENCH_ITERATIONS));
             } else if (strncmp(input, CMD_EXIT, strlen(CMD_EXIT)) == 0) {
                 pprintf("Exiting process id %d\n", pid);
                 proc_exit(0);
@@ -7,7 +7,7 @@
 
 #include <spede/stdbool.h>      // for bool type
 #include <spede/stddef.h>       // for size_t
-#include <spede/string.h>       // for memset
+#include <spede/string.h>       // for memset, memcpy
 
 #include "ringbuf.h"
 
@@ -23,11 +23,27 @@ int ringbuf_init(ringbuf_t *buf) {
         return -1;
     }
 
-    memset(buf, 0, RINGBUF_SIZE);
+    memset(buf, 0, sizeof(ringbuf_t));
+    queue_init(&buf->readers);
+    queue_init(&buf->writers);
 
     return 0;
 }
 
+/**
+ * Loads an index owned by the other side of the buffer
+ * Acquire ordering ensures data written before the index was published
+ * is visible before it is accessed
+ */
+#define ringbuf_load(index)         __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+
+/**
+ * Publishes an index owned by this side of the buffer
+ * Release ordering ensures the data accesses complete before the other
+ * side can observe the new index
+ */
+#define ringbuf_store(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
 /**
  * Writes a byte to the buffer
  * @param  buf   - pointer to the ring buffer structure
@@ -35,23 +51,20 @@ int ringbuf_init(ringbuf_t *buf) {
  * @return -1 on error; 0 on success
  */
 int ringbuf_write(ringbuf_t *buf, char byte) {
-    if (!buf) {
-        return -1;
-    }
+    unsigned int tail;
 
-    if (buf->size == RINGBUF_SIZE) {
+    if (!buf) {
         return -1;
     }
 
-    buf->data[buf->tail] = byte;
-
-    buf->tail++;
+    tail = buf->tail;
 
-    if (buf->tail == RINGBUF_SIZE) {
-        buf->tail = 0;
+    if (tail - ringbuf_load(buf->head) == RINGBUF_SIZE) {
+        return -1;
     }
 
-    buf->size++;
+    buf->data[tail & RINGBUF_MASK] = byte;
+    ringbuf_store(buf->tail, tail + 1);
 
     return 0;
 }
@@ -63,50 +76,62 @@ int ringbuf_write(ringbuf_t *buf, char byte) {
  * @return -1 on error; 0 on success
  */
 int ringbuf_read(ringbuf_t *buf, char *byte) {
-    if (!buf || !byte) {
-        return -1;
-    }
+    unsigned int head;
 
-    if (buf->size == 0) {
+    if (!buf || !byte) {
         return -1;
     }
 
-    *byte = buf->data[buf->head];
-
-    buf->head++;
+    head = buf->head;
 
-    if (buf->head == RINGBUF_SIZE) {
-        buf->head = 0;
+    if (ringbuf_load(buf->tail) == head) {
+        return -1;
     }
 
-    buf->size--;
+    *byte = buf->data[head & RINGBUF_MASK];
+    ringbuf_store(buf->head, head + 1);
 
     return 0;
 }
 
 /**
  * Copies multiple bytes to the buffer from the specified memory
+ * Copies as many bytes as fit if the buffer does not have room for all
  * @param buf - pointer to the ring buffer structure
  * @param mem - pointer to the memory location to copy from
  * @param size - number of bytes to copy
- * @return -1 on error, 0 on success
- * @note Should return an error if the number of bytes
- *       cannot be copied - i.e. the buffer would overflow
+ * @return -1 on error, otherwise the number of bytes copied
  */
 int ringbuf_write_mem(ringbuf_t *buf, char *mem, size_t size) {
-    if (!buf) {
+    unsigned int tail;
+    unsigned int space;
+    unsigned int offset;
+    size_t span;
+
+    if (!buf || !mem) {
         return -1;
     }
 
-    if (buf->size + size > RINGBUF_SIZE) {
-        return -1;
+    tail = buf->tail;
+    space = RINGBUF_SIZE - (tail - ringbuf_load(buf->head));
+
+    if (size > space) {
+        size = space;
     }
 
-    while (size-- && !ringbuf_is_full(buf)) {
-        ringbuf_write(buf, *mem++);
+    // Copy up to the end of the buffer, then wrap around once
+    offset = tail & RINGBUF_MASK;
+    span = RINGBUF_SIZE - offset;
+    if (span > size) {
+        span = size;
     }
 
-    return 0;
+    memcpy(&buf->data[offset], mem, span);
+    memcpy(&buf->data[0], mem + span, size - span);
+
+    ringbuf_store(buf->tail, tail + size);
+
+    return size;
 }
 
 /**
@@ -118,22 +143,40 @@ int ringbuf_write_mem(ringbuf_t *buf, char *mem, size_t size) {
  *         copied
  */
 int ringbuf_read_mem(ringbuf_t *buf, char *mem, size_t size) {
-    if (!buf) {
+    unsigned int head;
+    unsigned int avail;
+    unsigned int offset;
+    size_t span;
+
+    if (!buf || !mem) {
         return -1;
     }
 
-    int count = 0;
+    head = buf->head;
+    avail = ringbuf_load(buf->tail) - head;
+
+    if (size > avail) {
+        size = avail;
+    }
 
-    while (size-- && !ringbuf_is_empty(buf)) {
-        ringbuf_read(buf, mem++);
-        count++;
+    // Copy up to the end of the buffer, then wrap around once
+    offset = head & RINGBUF_MASK;
+    span = RINGBUF_SIZE - offset;
+    if (span > size) {
+        span = size;
     }
 
-    return count;
+    memcpy(mem, &buf->data[offset], span);
+    memcpy(mem + span, &buf->data[0], size - span);
+
+    ringbuf_store(buf->head, head + size);
+
+    return size;
 }
 
 /**
  * Flushes (empties) the buffer
+ * Must be called by the consumer (or while the consumer cannot run)
  * @param buf - pointer to the ring buffer structure
  * @return -1 on error, 0 on success
  */
@@ -142,7 +185,9 @@ int ringbuf_flush(ringbuf_t *buf) {
         return -1;
     }
 
-    memset(buf, 0, RINGBUF_SIZE);
+    // Discard everything written so far; the data does not need to be cleared
+    ringbuf_store(buf->head, ringbuf_load(buf->tail));
+
     return 0;
 }
 
@@ -152,7 +197,7 @@ int ringbuf_flush(ringbuf_t *buf) {
  * @return true if empty, false if not empty
  */
 bool ringbuf_is_empty(ringbuf_t *buf) {
-    return buf && buf->size == 0;
+    return buf && ringbuf_load(buf->tail) == ringbuf_load(buf->head);
 }
 
 /**
@@ -161,5 +206,5 @@ bool ringbuf_is_empty(ringbuf_t *buf) {
  * @return true if full, false if not full
  */
 bool ringbuf_is_full(ringbuf_t *buf) {
-    return buf && buf->size == RINGBUF_SIZE;
+    return buf && ringbuf_load(buf->tail) - ringbuf_load(buf->head) == RINGBUF_SIZE;
 }
@@ -6,11 +6,15 @@
  * Kernel Process Handling
  */
 
+// Log messages from this file belong to the scheduler subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_SCHEDULER
+
 #include <spede/string.h>
 #include <spede/stdio.h>
 #include <spede/time.h>
 #include <spede/machine/proc_reg.h>
 
+#include "bit_util.h"
 #include "kernel.h"
 #include "kproc.h"
 #include "scheduler.h"
@@ -19,42 +23,116 @@
 #include "queue.h"
 
 // Process Queues
-queue_t run_queue;      // Run queue -> processes that will be scheduled to run
-queue_t sleep_queue;    // Sleep queue -> processes that are currently sleeping
+queue_t run_queue[SCHEDULER_PRIORITY_LEVELS];   // Run queues -> one per priority level
+
+// Ready bitmap -> bit n is set when run_queue[n] has processes waiting to run
+int run_bitmap;
+
+// Set when the active process may need to be switched out: its time slice
+// expired, it blocked or exited, or a higher priority process became ready
+bool need_resched;
 
 /**
- * Scheduler timer callback
+ * Indicates if the given queue is one of the run queues
+ * @param queue - pointer to the queue
+ * @return true if the queue is a run queue, false otherwise
  */
-void scheduler_timer(void) {
-    int pid;
+bool scheduler_is_run_queue(queue_t *queue) {
+    return queue >= &run_queue[0] && queue < &run_queue[SCHEDULER_PRIORITY_LEVELS];
+}
+
+/**
+ * Moves a process to the given priority level
+ * If the process is in a run queue it is re-queued at the new level
+ * @param proc - pointer to the process entry
+ * @param priority - new priority level
+ */
+void scheduler_move(proc_t *proc, int priority) {
+    if (proc->priority == priority) {
+        return;
+    }
+
+    if (scheduler_is_run_queue(proc->scheduler_queue)) {
+        scheduler_remove(proc);
+        proc->priority = priority;
+        scheduler_add(proc);
+    } else {
+        // Takes effect the next time the process is added to the scheduler
+        proc->priority = priority;
+
+        // A waiting process may now outrank the active process
+        if (proc == active_proc) {
+            need_resched = true;
+        }
+    }
+}
+
+/**
+ * Boosts all processes back to their base priority
+ */
+void scheduler_boost(void) {
     proc_t *proc;
 
+    for (int i = 0; i < PROC_MAX; i++) {
+        proc = entry_to_proc(i);
+
+        if (proc && proc->state != NONE) {
+            scheduler_move(proc, proc->base_priority);
+
+            // Start a fresh time slice so the boost is not undone by an
+            // immediate demotion of the active process
+            proc->cpu_time = 0;
+        }
+    }
+}
+
+/**
+ * Scheduler timer callback
+ */
+void scheduler_timer(void) {
     // Update the active process' run time and CPU time
     if (active_proc) {
         active_proc->run_time++;
         active_proc->cpu_time++;
+
+        if (active_proc->cpu_time >= scheduler_timeslice(active_proc)) {
+            need_resched = true;
+        }
     }
 
-    for (int i = 0; i < sleep_queue.size; i++) {
-        pid = -1;
+#if SCHEDULER_MLFQ
+    // Periodically boost all processes to prevent starvation
+    if (timer_get_ticks() % SCHEDULER_MLFQ_BOOST == 0) {
+        scheduler_boost();
+    }
+#endif
+}
 
-        if (queue_out(&sleep_queue, &pid) != 0) {
-            kernel_log_warn("Unable to queue out of sleep queue");
-            continue;
-        }
+/**
+ * Timer event function that wakes a sleeping process
+ * @param data - pointer to the process entry
+ */
+void scheduler_wakeup(void *data) {
+    proc_t *proc = data;
 
-        proc = pid_to_proc(pid);
-        if (!proc) {
-            kernel_log_warn("Unable to look up process id %d", pid);
-            continue;
-        }
+    if (proc->state == SLEEPING) {
+        scheduler_add(proc);
+    }
+}
 
-        if (proc->sleep_time-- >= 0) {
-            queue_in(&sleep_queue, pid);
-        } else {
-            scheduler_add(proc);
-        }
+/**
+ * Determines if the scheduler needs to run before returning to the
+ * active process
+ * The idle task always goes through the scheduler so tickless idle mode
+ * can be re-entered after each interrupt
+ * @return true if scheduler_run must be called
+ */
+bool scheduler_preempt_pending(void) {
+    if (need_resched || !active_proc || active_proc->state != ACTIVE) {
+        return true;
     }
+
+    return active_proc->pid == 0;
 }
 
 /**
@@ -63,6 +141,12 @@ void scheduler_timer(void) {
  */
 void scheduler_run(void) {
     int pid;
+    int level;
+
+    // Resume periodic ticks once something other than the idle task is ready
+    if (run_bitmap) {
+        timer_tickless_exit();
+    }
 
     // Ensure that processes not in the active state aren't still scheduled
     if (active_proc && active_proc->state != ACTIVE) {
@@ -71,8 +155,22 @@ void scheduler_run(void) {
 
     // Check if we have an active process
     if (active_proc) {
-        // Check if the current process has exceeded it's time slice
-        if (active_proc->cpu_time >= SCHEDULER_TIMESLICE) {
+        // Highest priority level that has a process ready to run
+        level = bit_find_first(run_bitmap);
+
+        // Check if the current process has exceeded it's time slice or if a
+        // higher priority process is ready (the idle task yields to anything)
+        if (active_proc->cpu_time >= scheduler_timeslice(active_proc)
+            || (level >= 0 && (active_proc->pid == 0 || level < active_proc->priority))) {
+#if SCHEDULER_MLFQ
+            // Demote processes that used their entire time slice
+            if (active_proc->cpu_time >= scheduler_timeslice(active_proc)
+                && active_proc->priority - active_proc->base_priority < SCHEDULER_MLFQ_LEVELS - 1
+                && active_proc->priority < PROC_PRIORITY_MIN) {
+                active_proc->priority++;
+            }
+#endif
+
             // Reset the active time
             active_proc->cpu_time = 0;
 
@@ -94,23 +192,38 @@ void scheduler_run(void) {
 
     // Check if we have a process scheduled or not
     if (!active_proc) {
-        // Get the proces id from the run queue
-        if (queue_out(&run_queue, &pid) != 0) {
+        // Get the process id from the highest priority run queue
+        level = bit_find_first(run_bitmap);
+
+        if (level < 0 || queue_out(&run_queue[level], &pid) != 0) {
             // default to process id 0 (idle task)
             pid = 0;
+        } else if (queue_is_empty(&run_queue[level])) {
+            // Nothing else is ready at this level
+            run_bitmap = bit_clear(run_bitmap, level);
         }
 
         active_proc = pid_to_proc(pid);
-        kernel_log_trace("Scheduling process pid=%d, name=%s", active_proc->pid, active_proc->name);
-    }
 
-    // Make sure we have a valid process at this point
-    if (!active_proc) {
-        kernel_panic("Unable to schedule a process!");
+        // Make sure we have a valid process at this point
+        if (!active_proc) {
+            kernel_panic("Unable to schedule a process!");
+        }
+
+        // The process no longer resides in a run queue
+        active_proc->scheduler_queue = NULL;
+
+        kernel_log_trace("Scheduling process pid=%d, name=%s", active_proc->pid, active_proc->name);
     }
 
     // Ensure that the process state is correct
     active_proc->state = ACTIVE;
+    need_resched = false;
+
+    // Stop the periodic tick while only the idle task can run
+    if (active_proc->pid == 0) {
+        timer_tickless_enter();
+    }
 }
 
 /**
@@ -122,13 +235,25 @@ void scheduler_add(proc_t *proc) {
         kernel_panic("Invalid process!");
     }
 
-    proc->scheduler_queue = &run_queue;
+    if (proc->priority < PROC_PRIORITY_MAX || proc->priority > PROC_PRIORITY_MIN) {
+        kernel_panic("Invalid process priority %d", proc->priority);
+    }
+
+    proc->scheduler_queue = &run_queue[proc->priority];
     proc->state = IDLE;
     proc->cpu_time = 0;
 
     if (queue_in(proc->scheduler_queue, proc->pid) != 0) {
         kernel_panic("Unable to add the process to the scheduler");
     }
+
+    // Mark the priority level as ready
+    run_bitmap = bit_set(run_bitmap, proc->priority);
+
+    // Preempt the active process if this process outranks it
+    if (!active_proc || active_proc->pid == 0 || proc->priority < active_proc->priority) {
+        need_resched = true;
+    }
 }
 
 /**
@@ -161,34 +286,125 @@ void scheduler_remove(proc_t *proc) {
             }
         }
 
+        // Clear the ready bit if the priority level no longer has processes
+        if (scheduler_is_run_queue(proc->scheduler_queue) && queue_is_empty(proc->scheduler_queue)) {
+            run_bitmap = bit_clear(run_bitmap, proc->scheduler_queue - run_queue);
+        }
+
         // Set the queue to NULL since it does not exist in a queue any longer
         proc->scheduler_queue = NULL;
     }
 
+    // Cancel any pending wakeup
+    timer_event_cancel(&proc->sleep_event);
+
     // If the process is the current process, ensure that the current
     // process is reset so a new process will be scheduled
     if (proc == active_proc) {
         active_proc = NULL;
+        need_resched = true;
     }
 }
 
+/**
+ * Returns the time slice (in ticks) for the given process
+ * @param proc - pointer to the process entry
+ * @return number of ticks the process may run before being unscheduled
+ */
+int scheduler_timeslice(proc_t *proc) {
+#if SCHEDULER_MLFQ
+    // Lower levels get longer time slices
+    return SCHEDULER_TIMESLICE << (proc->priority - proc->base_priority);
+#else
+    return SCHEDULER_TIMESLICE;
+#endif
+}
+
+/**
+ * Sets the base scheduling priority of a process
+ * If the process is in a run queue it is moved to the new priority level
+ * @param proc - pointer to the process entry
+ * @param priority - new priority (PROC_PRIORITY_MAX to PROC_PRIORITY_MIN)
+ * @return 0 on success, -1 on error
+ */
+int scheduler_set_priority(proc_t *proc, int priority) {
+    if (!proc) {
+        kernel_panic("Invalid process");
+        return -1;
+    }
+
+    if (priority < PROC_PRIORITY_MAX || priority > PROC_PRIORITY_MIN) {
+        return -1;
+    }
+
+    kernel_log_debug("Setting process pid=%d priority from %d to %d", proc->pid, proc->base_priority, priority);
+
+    proc->base_priority = priority;
+    scheduler_move(proc, priority);
+
+    return 0;
+}
+
+/**
+ * Puts a process to sleep
+ * @param proc - pointer to the process entry
+ * @param time - number of ticks to sleep
+ */
 void scheduler_sleep(proc_t *proc, int time) {
     if (!proc) {
         kernel_panic("Invalid process");
         return;
     }
 
+    // Removing the process also cancels an existing wakeup
+    scheduler_remove(proc);
+
+    proc->state = SLEEPING;
     proc->sleep_time = time;
-    if (proc->state == SLEEPING) {
+
+    // Wake the process when the sleep time expires
+    proc->sleep_event.func = scheduler_wakeup;
+    proc->sleep_event.data = proc;
+    timer_event_add(&proc->sleep_event, time);
+}
+
+/**
+ * Blocks a process on a wait queue
+ * @param proc - pointer to the process entry
+ * @param queue - wait queue (process ids)
+ */
+void scheduler_wait(proc_t *proc, queue_t *queue) {
+    if (!proc || !queue) {
+        kernel_panic("Invalid process or wait queue");
         return;
     }
 
     scheduler_remove(proc);
 
-    proc->state = SLEEPING;
-    proc->scheduler_queue = &sleep_queue;
+    if (queue_in(queue, proc->pid) != 0) {
+        kernel_panic("Unable to add the process to the wait queue");
+    }
+
+    // Removing the process (e.g. on exit) also removes it from the wait queue
+    proc->scheduler_queue = queue;
+    proc->state = WAITING;
+}
+
+/**
+ * Wakes all processes blocked on a wait queue
+ * @param queue - wait queue (process ids)
+ */
+void scheduler_wake(queue_t *queue) {
+    proc_t *proc;
+    int pid;
+
+    while (queue_out(queue, &pid) == 0) {
+        proc = pid_to_proc(pid);
 
-    queue_in(proc->scheduler_queue, proc->pid);
+        if (proc && proc->state == WAITING) {
+            scheduler_add(proc);
+        }
+    }
 }
 
 /**
@@ -197,12 +413,15 @@ void scheduler_sleep(proc_t *proc, int time) {
 void scheduler_init(void) {
     kernel_log_info("Initializing scheduler");
 
-    /* Initialize the run queue */
-    queue_init(&run_queue);
+    /* Initialize the run queues */
+    for (int i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
+        queue_init(&run_queue[i]);
+    }
 
-    /* Initialize the sleep queue */
-    queue_init(&sleep_queue);
+    run_bitmap = 0;
+    need_resched = true;
 
     /* Register the timer callback */
-    timer_callback_register(&scheduler_timer, 1, -1);
+    /* Accounting for idle ticks may be caught up when the CPU wakes */
+    timer_callback_set_deferrable(timer_callback_register(&scheduler_timer, 1, -1));
 }
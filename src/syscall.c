@@ -5,6 +5,37 @@
  * System call APIs
  */
 #include "syscall.h"
+#include "vdso.h"
+
+// Shared kernel data page (looked up on first use)
+vdso_data_t *vdso;
+
+/**
+ * Executes a system call through the SYSENTER entry
+ * The kernel resumes the caller at the address in ESI with the stack
+ * pointer in EBP, popping the EFLAGS pushed before entering so the
+ * caller's interrupt state is preserved
+ * @param syscall - the system call identifier
+ * @param arg1 - first argument
+ * @param arg2 - second argument
+ * @param arg3 - third argument
+ * @return return code from the the system call
+ */
+int _syscall_sysenter(int syscall, int arg1, int arg2, int arg3) {
+    int rc = -1;
+
+    asm volatile("pushl %%ebp;"
+        "pushfl;"
+        "movl %%esp, %%ebp;"
+        "movl $1f, %%esi;"
+        "sysenter;"
+        "1: popl %%ebp;"
+        : "=a"(rc)
+        : "a"(syscall), "b"(arg1), "c"(arg2), "d"(arg3)
+        : "%esi", "memory", "cc");
+
+    return rc;
+}
 
 /**
  * Executes a system call without any arguments
@@ -14,6 +45,11 @@
 int _syscall0(int syscall) {
     int rc = -1;
 
+    // Use the fast entry once the kernel has indicated it is available
+    if (vdso && vdso->sysenter) {
+        return _syscall_sysenter(syscall, 0, 0, 0);
+    }
+
     asm("movl %1, %%eax;"
         "int $0x80;"
         "movl %%eax, %0;"
@@ -33,6 +69,11 @@ int _syscall0(int syscall) {
 int _syscall1(int syscall, int arg1) {
     int rc = -1;
 
+    // Use the fast entry once the kernel has indicated it is available
+    if (vdso && vdso->sysenter) {
+        return _syscall_sysenter(syscall, arg1, 0, 0);
+    }
+
     asm("movl %1, %%eax;"
         "movl %2, %%ebx;"
         "int $0x80;"
@@ -54,6 +95,11 @@ int _syscall1(int syscall, int arg1) {
 int _syscall2(int syscall, int arg1, int arg2) {
     int rc = -1;
 
+    // Use the fast entry once the kernel has indicated it is available
+    if (vdso && vdso->sysenter) {
+        return _syscall_sysenter(syscall, arg1, arg2, 0);
+    }
+
     asm("movl %1, %%eax;"
         "movl %2, %%ebx;"
         "movl %3, %%ecx;"
@@ -77,6 +123,11 @@ int _syscall2(int syscall, int arg1, int arg2) {
 int _syscall3(int syscall, int arg1, int arg2, int arg3) {
     int rc = -1;
 
+    // Use the fast entry once the kernel has indicated it is available
+    if (vdso && vdso->sysenter) {
+        return _syscall_sysenter(syscall, arg1, arg2, arg3);
+    }
+
     asm("movl %1, %%eax;"
         "movl %2, %%ebx;"
         "movl %3, %%ecx;"
@@ -90,12 +141,65 @@ int _syscall3(int syscall, int arg1, int arg2, int arg3) {
     return rc;
 }
 
+/**
+ * Returns the shared kernel data page
+ * The address is requested from the kernel once and cached
+ * @return pointer to the shared data page
+ */
+vdso_data_t *sys_get_vdso(void) {
+    if (!vdso) {
+        vdso = (vdso_data_t *)_syscall0(SYSCALL_SYS_GET_VDSO);
+    }
+
+    return vdso;
+}
+
+/**
+ * Measures the average round trip cost of a system call
+ * @param fast - non-zero to use the SYSENTER entry, zero to use int $0x80
+ * @param iterations - number of system calls to make
+ * @return average TSC cycles per system call, -1 on error
+ */
+int sys_bench(int fast, int iterations) {
+    unsigned long long start;
+    unsigned int cycles;
+
+    if (iterations <= 0 || (fast && !sys_get_vdso()->sysenter)) {
+        return -1;
+    }
+
+    start = vdso_rdtsc();
+
+    for (int i = 0; i < iterations; i++) {
+        if (fast) {
+            _syscall_sysenter(SYSCALL_PROC_GET_PID, 0, 0, 0);
+        } else {
+            // The return value is written to EAX
+            int syscall = SYSCALL_PROC_GET_PID;
+            asm volatile("int $0x80" : "+a"(syscall) : : "memory");
+        }
+    }
+
+    cycles = vdso_rdtsc() - start;
+
+    return cycles / iterations;
+}
+
 /**
  * Gets the current system time (in seconds)
  * @return system time in seconds
  */
 int sys_get_time(void) {
-    return _syscall0(SYSCALL_SYS_GET_TIME);
+    vdso_data_t *data = sys_get_vdso();
+    unsigned int seq;
+    int ticks;
+
+    do {
+        seq = vdso_read_begin(data);
+        ticks = data->ticks;
+    } while (vdso_read_retry(data, seq));
+
+    return ticks / data->hz;
 }
 
 /**
@@ -104,7 +208,52 @@ int sys_get_time(void) {
  * @return 0 on success, -1 or other non-zero value on error
  */
 int sys_get_name(char *name) {
-    return _syscall1(SYSCALL_SYS_GET_NAME, (int)name);
+    vdso_data_t *data = sys_get_vdso();
+    int i;
+
+    if (!name) {
+        return -1;
+    }
+
+    // The name is published once at startup
+    for (i = 0; i < VDSO_NAME_LEN - 1 && data->os_name[i]; i++) {
+        name[i] = data->os_name[i];
+    }
+
+    name[i] = '\0';
+    return 0;
+}
+
+/**
+ * Gets the current monotonic system time in nanoseconds
+ * @return time since startup in nanoseconds
+ */
+unsigned long long sys_get_time_ns(void) {
+    vdso_data_t *data = sys_get_vdso();
+    unsigned long long ns;
+    unsigned int seq;
+
+    do {
+        seq = vdso_read_begin(data);
+
+        if (data->tsc_mult) {
+            ns = vdso_tsc_to_ns(vdso_rdtsc() - data->tsc_base, data->tsc_mult, data->tsc_shift);
+        } else {
+            ns = (unsigned long long)data->ticks * data->ns_per_tick;
+        }
+    } while (vdso_read_retry(data, seq));
+
+    return ns;
+}
+
+/**
+ * Gets the kernel statistics for the specified system call
+ * @param syscall - system call identifier
+ * @param stats - pointer to where the statistics will be copied
+ * @return 0 on success, -1 on error
+ */
+int sys_get_stats(int syscall, syscall_stats_t *stats) {
+    return _syscall2(SYSCALL_SYS_GET_STATS, syscall, (int)stats);
 }
 
 /**
@@ -115,6 +264,15 @@ void proc_sleep(int secs) {
     _syscall1(SYSCALL_PROC_SLEEP, secs);
 }
 
+/**
+ * Puts the current process to sleep for the specified number of nanoseconds
+ * The duration is rounded up to the timer resolution
+ * @param ns - number of nanoseconds the process should sleep
+ */
+void proc_sleep_ns(unsigned long long ns) {
+    _syscall2(SYSCALL_PROC_SLEEP_NS, (int)ns, (int)(ns >> 32));
+}
+
 /**
  * Exits the current process
  * @param exitcode An exit code to return to the parent process
@@ -140,15 +298,44 @@ int proc_get_name(char *name) {
     return _syscall1(SYSCALL_PROC_GET_NAME, (int)name);
 }
 
+/**
+ * Sets the current process' scheduling priority
+ * @param priority - new priority (PROC_PRIORITY_MAX to PROC_PRIORITY_MIN)
+ * @return 0 on success, -1 on error
+ */
+int proc_set_priority(int priority) {
+    return _syscall1(SYSCALL_PROC_SET_PRIORITY, priority);
+}
+
 /**
  * Writes up to n bytes to the process' specified IO buffer
+ * If PROC_IO_BLOCK is set in io, waits until all n bytes are written;
+ * otherwise returns PROC_IO_EAGAIN if the buffer is full
  * @param io - the IO buffer to write to
  * @param buf - the buffer to copy from
  * @param n - number of bytes to write
  * @return -1 on error or value indicating number of bytes copied
  */
 int io_write(int io, char *buf, int n) {
-    return _syscall3(SYSCALL_IO_WRITE, io, (int)buf, n);
+    int written = 0;
+    int rc;
+
+    if (!(io & PROC_IO_BLOCK)) {
+        return _syscall3(SYSCALL_IO_WRITE, io, (int)buf, n);
+    }
+
+    // A blocking write returns 0 after being woken; write the rest
+    while (written < n) {
+        rc = _syscall3(SYSCALL_IO_WRITE, io, (int)&buf[written], n - written);
+
+        if (rc < 0) {
+            return written ? written : rc;
+        }
+
+        written += rc;
+    }
+
+    return written;
 }
 
 /**
@@ -159,7 +346,14 @@ int io_write(int io, char *buf, int n) {
  * @return -1 on error or value indicating number of bytes copied
  */
 int io_read(int io, char *buf, int n) {
-    return _syscall3(SYSCALL_IO_READ, io, (int)buf, n);
+    int rc;
+
+    // A blocking read returns 0 after being woken; read again
+    do {
+        rc = _syscall3(SYSCALL_IO_READ, io, (int)buf, n);
+    } while (rc == 0 && n > 0 && (io & PROC_IO_BLOCK));
+
+    return rc;
 }
 
 /**
@@ -171,6 +365,16 @@ int io_flush(int io) {
     return _syscall1(SYSCALL_IO_FLUSH, io);
 }
 
+/**
+ * Sets the input mode of the TTY attached to the specified IO buffer
+ * @param io - the IO buffer (must be the TTY input)
+ * @param mode - input mode flags (PROC_IO_MODE_*)
+ * @return -1 on error or 0 on success
+ */
+int io_set_mode(int io, int mode) {
+    return _syscall2(SYSCALL_IO_SET_MODE, io, mode);
+}
+
 /**
  * Allocates a mutex from the kernel
  * @return -1 on error, all other values indicate the mutex id
@@ -4,21 +4,50 @@
  *
  * Timer Implementation
  */
+// Log messages from this file belong to the timer subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_TIMER
+
 #include <spede/string.h>
+#include <spede/machine/io.h>
 
 #include "interrupts.h"
 #include "kernel.h"
 #include "queue.h"
 #include "timer.h"
+#include "vdso.h"
+
+// Programmable Interval Timer (PIT) definitions
+#define PIT_FREQUENCY       1193182     // PIT input clock frequency (Hz)
+#define PIT_PORT_CHANNEL0   0x40        // Channel 0 data port
+#define PIT_PORT_COMMAND    0x43        // Mode/command port
+#define PIT_CMD_PERIODIC    0x34        // Channel 0, lo/hi byte, mode 2 (rate generator)
+#define PIT_CMD_ONESHOT     0x30        // Channel 0, lo/hi byte, mode 0 (interrupt on terminal count)
+#define PIT_CMD_LATCH       0x00        // Channel 0 counter latch
+#define PIT_CMD_CALIBRATE   0xB0        // Channel 2, lo/hi byte, mode 0 (interrupt on terminal count)
+#define PIT_PORT_CHANNEL2   0x42        // Channel 2 data port
+#define PIT_PORT_GATE       0x61        // Channel 2 gate / speaker control port
+#define PIT_GATE_ENABLE     0x01        // Channel 2 gate input
+#define PIT_GATE_SPEAKER    0x02        // Speaker data enable
+#define PIT_GATE_OUT        0x20        // Channel 2 output status
+
+// Duration of the TSC calibration interval
+#define TIMER_TSC_CALIBRATE_MS  10
+
+// PIT counts per timer tick
+#define PIT_DIVISOR         (PIT_FREQUENCY / TIMER_HZ)
+
+// Maximum number of ticks a single one-shot PIT count can cover
+#define TIMER_TICKLESS_MAX  (0xFFFF / PIT_DIVISOR)
 
 /**
  * Data structures
  */
 // Timer data structure
 typedef struct timer_t {
-    void (*callback)(); // Function to call when the interval occurs
-    int interval;       // Interval in which the timer will be called
-    int repeat;         // Indicate how many intervals to repeat (-1 should repeat forever)
+    timer_event_t event;    // Timer wheel event
+    void (*callback)();     // Function to call when the interval occurs
+    int interval;           // Interval in which the timer will be called
+    int repeat;             // Indicate how many intervals to repeat (-1 should repeat forever)
 } timer_t;
 
 /**
@@ -34,6 +63,207 @@ timer_t timers[TIMERS_MAX];
 // Timer allocator; used to allocate indexes into the timers table
 queue_t timer_allocator; // Struct contains head, tail, size, items[]
 
+// Timer wheel; level 0 has one slot per tick, each higher level
+// has one slot per full rotation of the level below it
+timer_event_t *timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+
+// Events that are expiring on the current tick
+timer_event_t *timer_expiring;
+
+// Number of ticks programmed into the one-shot timer (0 if not tickless)
+int timer_tickless_ticks;
+
+// PIT count programmed into the one-shot timer
+int timer_tickless_count;
+
+// A timer interrupt raised while leaving tickless idle mode is pending and
+// does not represent a new tick
+int timer_tickless_stale;
+
+// TSC calibration
+//   ns = ((tsc - timer_tsc_base) * timer_tsc_mult) >> TIMER_TSC_SHIFT
+unsigned long long timer_tsc_base;
+unsigned int timer_tsc_khz;
+unsigned int timer_tsc_mult;
+
+/**
+ * Divides a 64-bit value by a 32-bit value
+ * Uses a single divl instead of relying on compiler runtime support
+ * @param n - dividend
+ * @param d - divisor
+ * @return quotient, or 0xFFFFFFFF if the quotient does not fit in 32 bits
+ */
+unsigned int timer_div64(unsigned long long n, unsigned int d) {
+    unsigned int hi = n >> 32;
+    unsigned int lo = n;
+    unsigned int q;
+    unsigned int r;
+
+    if (hi >= d) {
+        return 0xFFFFFFFF;
+    }
+
+    asm("divl %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+
+    return q;
+}
+
+/**
+ * Programs the PIT to interrupt periodically at TIMER_HZ
+ */
+void timer_pit_periodic(void) {
+    outportb(PIT_PORT_COMMAND, PIT_CMD_PERIODIC);
+    outportb(PIT_PORT_CHANNEL0, PIT_DIVISOR & 0xFF);
+    outportb(PIT_PORT_CHANNEL0, (PIT_DIVISOR >> 8) & 0xFF);
+}
+
+/**
+ * Programs the PIT to interrupt once after the specified number of counts
+ * @param count - number of PIT counts (up to 0xFFFF)
+ */
+void timer_pit_oneshot(int count) {
+    outportb(PIT_PORT_COMMAND, PIT_CMD_ONESHOT);
+    outportb(PIT_PORT_CHANNEL0, count & 0xFF);
+    outportb(PIT_PORT_CHANNEL0, (count >> 8) & 0xFF);
+}
+
+/**
+ * Reads the current PIT channel 0 count
+ * @return the current count
+ */
+int timer_pit_read(void) {
+    int count;
+
+    outportb(PIT_PORT_COMMAND, PIT_CMD_LATCH);
+    count = inportb(PIT_PORT_CHANNEL0);
+    count |= inportb(PIT_PORT_CHANNEL0) << 8;
+
+    return count;
+}
+
+/**
+ * Links an event into the wheel slot based upon its expiration
+ * @param event - pointer to the event
+ */
+void timer_wheel_insert(timer_event_t *event) {
+    timer_event_t **slot;
+    int delta = event->expires - timer_ticks;
+    int level;
+
+    // Find the lowest level that can represent the delta
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < (1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+
+    slot = &timer_wheel[level][(event->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+
+    // Link the event to the head of the slot
+    event->next = *slot;
+    if (event->next) {
+        event->next->pprev = &event->next;
+    }
+
+    event->pprev = slot;
+    *slot = event;
+}
+
+/**
+ * Unlinks an event from the list it resides in
+ * @param event - pointer to the event
+ */
+void timer_wheel_unlink(timer_event_t *event) {
+    *event->pprev = event->next;
+
+    if (event->next) {
+        event->next->pprev = event->pprev;
+    }
+
+    event->next = NULL;
+    event->pprev = NULL;
+}
+
+/**
+ * Moves all events in the current slot of the given level to lower levels
+ * @param level - wheel level to cascade
+ */
+void timer_wheel_cascade(int level) {
+    timer_event_t **slot = &timer_wheel[level][(timer_ticks >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+    timer_event_t *event;
+
+    while (*slot) {
+        event = *slot;
+        timer_wheel_unlink(event);
+        timer_wheel_insert(event);
+    }
+}
+
+/**
+ * Adds an event to the timer wheel
+ * If the event is already pending it is rescheduled
+ * @param event - pointer to the event (func and data must be set)
+ * @param ticks - number of ticks until the event expires
+ */
+void timer_event_add(timer_event_t *event, int ticks) {
+    if (!event || !event->func) {
+        kernel_panic("timer: invalid event");
+        return;
+    }
+
+    timer_event_cancel(event);
+
+    // Events expire no sooner than the next tick and no later than
+    // the wheel is able to represent
+    if (ticks < 1) {
+        ticks = 1;
+    } else if (ticks >= TIMER_WHEEL_RANGE) {
+        ticks = TIMER_WHEEL_RANGE - 1;
+    }
+
+    event->expires = timer_ticks + ticks;
+    timer_wheel_insert(event);
+}
+
+/**
+ * Cancels a pending event
+ * Has no effect if the event is not pending
+ * @param event - pointer to the event
+ */
+void timer_event_cancel(timer_event_t *event) {
+    if (event && event->pprev) {
+        timer_wheel_unlink(event);
+    }
+}
+
+/**
+ * Timer wheel function for callback timers
+ * Runs the callback and re-arms the timer if it should repeat
+ * @param data - pointer to the timer
+ */
+void timer_callback_expired(void *data) {
+    timer_t *timer = data;
+
+    timer->callback();
+
+    // The callback may have unregistered the timer
+    if (!timer->callback) {
+        return;
+    }
+
+    if (timer->repeat == 0) {
+        // No more repeats, unregister the timer
+        timer_callback_unregister(timer - timers);
+        return;
+    }
+
+    // If the timer repeat is greater than 0, decrement
+    if (timer->repeat > 0) {
+        timer->repeat--;
+    }
+
+    timer_event_add(&timer->event, timer->interval);
+}
 
 /**
  * Registers a new callback to be called at the specified interval
@@ -53,6 +283,11 @@ int timer_callback_register(void (*func_ptr)(), int interval, int repeat) {
         return -1;
     }
 
+    if (interval < 1) {
+        kernel_log_error("timer: invalid interval %d", interval);
+        return -1;
+    }
+
     // Obtain a timer id from queue
     if (queue_out(&timer_allocator, &timer_id) != 0) {
         kernel_log_error("timer: unable to allocate a timer");
@@ -67,6 +302,11 @@ int timer_callback_register(void (*func_ptr)(), int interval, int repeat) {
     timer->interval = interval;
     timer->repeat = repeat;
 
+    // Fire on tick counts that are a multiple of the interval
+    timer->event.func = timer_callback_expired;
+    timer->event.data = timer;
+    timer_event_add(&timer->event, interval - (timer_ticks % interval));
+
     // Return timer_id to the calling function
     return timer_id;
 }
@@ -87,6 +327,15 @@ int timer_callback_unregister(int id) {
 
     // Set local timer pointer to address of the timer being unregistered 
     timer = &timers[id];
+
+    if (!timer->callback) {
+        kernel_log_error("timer: callback id not registered: %d", id);
+        return -1;
+    }
+
+    // Remove the timer from the wheel
+    timer_event_cancel(&timer->event);
+
     // Clear out memory for the timer 
     memset(timer, 0, sizeof(timer_t));
 
@@ -99,6 +348,62 @@ int timer_callback_unregister(int id) {
     return 0;
 }
 
+/**
+ * Marks the specified callback as deferrable
+ * Deferrable callbacks do not wake the CPU from tickless idle; they run
+ * on the first tick after the CPU leaves idle
+ * @param id - timer id
+ *
+ * @return 0 on success, -1 on error
+ */
+int timer_callback_set_deferrable(int id) {
+    if (id < 0 || id >= TIMERS_MAX || !timers[id].callback) {
+        kernel_log_error("timer: invalid callback id: %d", id);
+        return -1;
+    }
+
+    timers[id].event.deferrable = 1;
+
+    return 0;
+}
+
+/**
+ * Reads the CPU time stamp counter
+ * @return current time stamp counter value
+ */
+unsigned long long timer_get_tsc(void) {
+    return vdso_rdtsc();
+}
+
+/**
+ * Returns the number of nanoseconds that have elapsed since startup
+ * Backed by the TSC (calibrated against the PIT) when available,
+ * otherwise by the timer tick count
+ * @return monotonic time in nanoseconds
+ */
+unsigned long long timer_get_ns(void) {
+    if (!timer_tsc_mult) {
+        return (unsigned long long)timer_ticks * TIMER_NS_PER_TICK;
+    }
+
+    return vdso_tsc_to_ns(timer_get_tsc() - timer_tsc_base, timer_tsc_mult, TIMER_TSC_SHIFT);
+}
+
+/**
+ * Converts a duration in nanoseconds to timer ticks, rounding up
+ * @param ns - duration in nanoseconds
+ * @return number of ticks
+ */
+int timer_ns_to_ticks(unsigned long long ns) {
+    unsigned int ticks = timer_div64(ns + TIMER_NS_PER_TICK - 1, TIMER_NS_PER_TICK);
+
+    if (ticks > 0x7FFFFFFF) {
+        return 0x7FFFFFFF;
+    }
+
+    return ticks;
+}
+
 /**
  * Returns the number of ticks that have occured since startup
  *
@@ -109,41 +414,229 @@ int timer_get_ticks() {
 }
 
 /**
- * Timer IRQ Handler
- *
- * Should perform the following:
- *   - Increment the timer ticks every time the timer occurs
- *   - Handle each registered timer
- *     - If the interval is hit, run the callback function
- *     - Handle timer repeats
+ * Advances the timer by one tick
+ *   - Increment the timer ticks
+ *   - Cascade events from higher wheel levels when a level wraps
+ *   - Run every event expiring on this tick
  */
-void timer_irq_handler(void) {
-    timer_t *timer;
+void timer_tick(void) {
+    timer_event_t **slot;
+    timer_event_t *event;
 
     // Increment the timer_ticks value
     timer_ticks++;
+    vdso_update_ticks(timer_ticks);
 
-    // Iterate through the timers table
-    for (int i = 0; i < TIMERS_MAX; i++) {
-        // Load up first timer into local var 
-        timer = &timers[i];
-
-        // If we have a valid callback, check if it needs to be called
-        if (timer->callback) {
-            // If the timer interval is hit, run the callback function
-            if (timer_ticks % timer->interval == 0) {
-                timer->callback();
-            }
+    // Each time a level wraps, pull the next slot of the level above it down
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if ((timer_ticks & ((1 << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+            break;
+        }
+
+        timer_wheel_cascade(level);
+    }
+
+    // Detach the slot for this tick so expiring events may add or cancel events
+    slot = &timer_wheel[0][timer_ticks & TIMER_WHEEL_MASK];
+    timer_expiring = *slot;
+    *slot = NULL;
+
+    if (timer_expiring) {
+        timer_expiring->pprev = &timer_expiring;
+    }
+
+    while (timer_expiring) {
+        event = timer_expiring;
+        timer_wheel_unlink(event);
+        event->func(event->data);
+    }
+}
+
+/**
+ * Returns the number of ticks until the next event that must wake the CPU
+ * @param max - maximum number of ticks to look ahead
+ * @return number of ticks (1 to max)
+ */
+int timer_next_event(int max) {
+    timer_event_t *event;
+    int tick;
+
+    for (int ticks = 1; ticks < max; ticks++) {
+        tick = timer_ticks + ticks;
 
-            // If the timer repeat is greater than 0, decrement
-            if (timer->repeat > 0) {
-                timer->repeat--;
-            } else if (timer->repeat == 0) {
-                // If the timer repeat is equal to 0, unregister the timer
-                timer_callback_unregister(i);
+        // Events may cascade into level 0 when it wraps
+        if ((tick & TIMER_WHEEL_MASK) == 0) {
+            return ticks;
+        }
+
+        // Every event in a level 0 slot expires on that slot's tick
+        for (event = timer_wheel[0][tick & TIMER_WHEEL_MASK]; event; event = event->next) {
+            if (!event->deferrable) {
+                return ticks;
             }
         }
     }
+
+    return max;
+}
+
+/**
+ * Enters tickless idle mode if no events are pending in the near future
+ * Should be called when the idle task is scheduled
+ */
+void timer_tickless_enter(void) {
+#if TIMER_TICKLESS
+    int ticks;
+
+    if (timer_tickless_ticks) {
+        return;
+    }
+
+    // Skipping a single tick isn't worth reprogramming the PIT
+    ticks = timer_next_event(TIMER_TICKLESS_MAX);
+    if (ticks < 2) {
+        return;
+    }
+
+    // Keep the tick boundaries: the first tick ends when the current
+    // period would have, the rest are full periods
+    timer_tickless_count = (ticks - 1) * PIT_DIVISOR + timer_pit_read();
+    timer_pit_oneshot(timer_tickless_count);
+    timer_tickless_ticks = ticks;
+#endif
+}
+
+/**
+ * Leaves tickless idle mode and resumes periodic ticks on the same tick
+ * boundaries, so partial ticks are carried forward instead of lost
+ * @param irq - called for the one-shot timer interrupt
+ * @return number of tick boundaries that passed while idle
+ */
+static int timer_tickless_stop(int irq) {
+    // PIT counts until the first tick boundary
+    int first = timer_tickless_count - (timer_tickless_ticks - 1) * PIT_DIVISOR;
+    // PIT counts since the one-shot was programmed (the count wraps after
+    // reaching zero)
+    int elapsed = (timer_tickless_count - timer_pit_read()) & 0xFFFF;
+    int ticks = 0;
+    int next = first - elapsed;
+
+    if (elapsed >= first) {
+        ticks = 1 + (elapsed - first) / PIT_DIVISOR;
+        next = PIT_DIVISOR - (elapsed - first) % PIT_DIVISOR;
+    }
+
+    // The rate generator can't count less than 2; the boundary is imminent
+    if (next < 2) {
+        ticks++;
+        next += PIT_DIVISOR;
+    }
+
+    // Switching to the rate generator before the one-shot expired raises
+    // the PIT output; otherwise, unless this is its interrupt, the one-shot
+    // interrupt is pending. Either way the interrupt is already counted
+    timer_tickless_stale = elapsed < timer_tickless_count || !irq;
+
+    // Finish the current tick with the remaining count; the full divisor
+    // is loaded when that period ends
+    outportb(PIT_PORT_COMMAND, PIT_CMD_PERIODIC);
+    outportb(PIT_PORT_CHANNEL0, next & 0xFF);
+    outportb(PIT_PORT_CHANNEL0, (next >> 8) & 0xFF);
+    outportb(PIT_PORT_CHANNEL0, PIT_DIVISOR & 0xFF);
+    outportb(PIT_PORT_CHANNEL0, (PIT_DIVISOR >> 8) & 0xFF);
+
+    timer_tickless_ticks = 0;
+
+    return ticks;
+}
+
+/**
+ * Exits tickless idle mode (if active), restoring the periodic timer and
+ * accounting for the ticks that elapsed while idle
+ */
+void timer_tickless_exit(void) {
+    int elapsed;
+
+    if (!timer_tickless_ticks) {
+        return;
+    }
+
+    elapsed = timer_tickless_stop(0);
+
+    while (elapsed-- > 0) {
+        timer_tick();
+    }
+}
+
+/**
+ * Calibrates the TSC against PIT channel 2
+ * Measures the number of TSC cycles that elapse while channel 2 counts
+ * down a fixed interval
+ */
+void timer_tsc_calibrate(void) {
+    int count = PIT_FREQUENCY / (1000 / TIMER_TSC_CALIBRATE_MS);
+    unsigned long long start;
+    unsigned long long end;
+    int gate;
+
+    // Enable the channel 2 gate with the speaker output disabled
+    gate = inportb(PIT_PORT_GATE);
+    outportb(PIT_PORT_GATE, (gate & ~PIT_GATE_SPEAKER) | PIT_GATE_ENABLE);
+
+    // Start the countdown; the output goes high when it reaches zero
+    outportb(PIT_PORT_COMMAND, PIT_CMD_CALIBRATE);
+    outportb(PIT_PORT_CHANNEL2, count & 0xFF);
+    outportb(PIT_PORT_CHANNEL2, (count >> 8) & 0xFF);
+
+    start = timer_get_tsc();
+    while (!(inportb(PIT_PORT_GATE) & PIT_GATE_OUT));
+    end = timer_get_tsc();
+
+    // Restore the gate
+    outportb(PIT_PORT_GATE, gate);
+
+    timer_tsc_base = end;
+    timer_tsc_khz = timer_div64(end - start, TIMER_TSC_CALIBRATE_MS);
+
+    if (timer_tsc_khz < 1000) {
+        kernel_log_warn("timer: TSC unusable (%u kHz), using timer ticks", timer_tsc_khz);
+        timer_tsc_mult = 0;
+    } else {
+        timer_tsc_mult = timer_div64(1000000ULL << TIMER_TSC_SHIFT, timer_tsc_khz);
+        kernel_log_info("timer: TSC calibrated at %u kHz", timer_tsc_khz);
+    }
+
+    // Publish the calibration so user code can convert the TSC itself
+    vdso_update_tsc(timer_tsc_base, timer_tsc_mult, TIMER_TSC_SHIFT);
+}
+
+/**
+ * Timer IRQ Handler
+ *
+ * Advances the timer by one tick, or by every tick that elapsed
+ * while in tickless idle mode
+ */
+void timer_irq_handler(void) {
+    int elapsed = 1;
+
+    if (timer_tickless_stale) {
+        // Raised while leaving tickless idle mode; the ticks were counted then
+        timer_tickless_stale = 0;
+        return;
+    }
+
+    if (timer_tickless_ticks) {
+        // The one-shot timer expired; resume periodic ticks. A periodic
+        // tick that was pending when idle started still counts as one
+        elapsed = timer_tickless_stop(1);
+        if (elapsed < 1) {
+            elapsed = 1;
+        }
+    }
+
+    while (elapsed-- > 0) {
+        timer_tick();
+    }
 }
 
 /**
@@ -157,6 +650,10 @@ void timer_init(void) {
 
     // Initialize the timers data structures
     memset(timers, 0, sizeof(timers));
+    memset(timer_wheel, 0, sizeof(timer_wheel));
+    timer_expiring = NULL;
+    timer_tickless_ticks = 0;
+    timer_tickless_stale = 0;
 
     // Initialize the timer callback allocator queue
     queue_init(&timer_allocator);
@@ -170,6 +667,12 @@ void timer_init(void) {
         }
     }
 
+    // Calibrate the TSC before the PIT starts generating ticks
+    timer_tsc_calibrate();
+
+    // Program the PIT for periodic ticks
+    timer_pit_periodic();
+
     // Register the Timer IRQ
     // Note: isr_entry_timer is from interrupts.h and timer_irq_handler 
     // is our function above.
@@ -5,12 +5,26 @@
  * TTY Definitions
  */
 
+// Log messages from this file belong to the tty subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_TTY
+
 #include <spede/string.h>
 
 #include "kernel.h"
+#include "scheduler.h"
 #include "timer.h"
 #include "tty.h"
 #include "vga.h"
+#include "workqueue.h"
+
+// Number of bytes drained from a TTY output buffer at a time
+#define TTY_REFRESH_CHUNK 128
+
+// ANSI color number to VGA color
+static const unsigned char tty_ansi_color[8] = {
+    VGA_COLOR_BLACK, VGA_COLOR_RED, VGA_COLOR_GREEN, VGA_COLOR_BROWN,
+    VGA_COLOR_BLUE, VGA_COLOR_MAGENTA, VGA_COLOR_CYAN, VGA_COLOR_LIGHT_GREY
+};
 
 // TTY Table
 struct tty_t tty_table[TTY_MAX];
@@ -18,6 +32,9 @@ struct tty_t tty_table[TTY_MAX];
 // Current Active TTY
 struct tty_t *active_tty;
 
+// Work item that refreshes the TTY
+work_t tty_refresh_work;
+
 /**
  * Sets the active TTY to the selected TTY number
  * @param tty - TTY number
@@ -30,7 +47,7 @@ void tty_select(int n) {
     active_tty = &tty_table[n];
     kernel_log_info("tty[%d]: selected", n);
 
-    active_tty->refresh = 1;
+    active_tty->dirty = TTY_DIRTY_ALL;
 }
 
 /**
@@ -63,33 +80,34 @@ void tty_refresh(void) {
         return;
     }
 
-    struct tty_t *tty = active_tty;
-    char c;
+    struct tty_t *tty;
+    char buf[TTY_REFRESH_CHUNK];
+    int cursor;
+    int n;
 
-    // Handle new I/O
-    while (!ringbuf_is_empty(&tty->io_output)) {
-        if (ringbuf_read(&tty->io_output, &c) == 0) {
-            tty_update(c);
-        }
-    }
+    // Handle new I/O for every TTY so background output is not dropped,
+    // draining each output buffer in chunks
+    for (int i = 0; i < TTY_MAX; i++) {
+        tty = &tty_table[i];
 
-    if (tty->refresh) {
-        kernel_log_trace("tty[%d]: refreshing", tty->id);
+        while ((n = ringbuf_read_mem(&tty->io_output, buf, sizeof(buf))) > 0) {
+            tty_write(tty, buf, n);
 
-        int x = 0;
-        int y = 0;
+            // Space was freed for blocked writers
+            scheduler_wake(&tty->io_output.writers);
+        }
+    }
 
-        for (int i = 0; i < TTY_WIDTH * TTY_HEIGHT; i++) {
-            if (x >= VGA_WIDTH) {
-                x = 0;
-                y++;
-            }
+    tty = active_tty;
 
-            vga_putc_at(x++, y, tty->color_bg, tty->color_fg, tty->buf[tty->pos_scroll*TTY_WIDTH + i]);
-        }
+    // Cursor only moves (newline, backspace, etc.) do not dirty any rows
+    cursor = tty->pos_x + (tty->pos_y + tty->pos_scroll) * TTY_WIDTH;
 
-        // The screen has been refreshed, so clea the refresh flag
-        tty->refresh = 0;
+    // Redraw only the rows that changed
+    if (tty->dirty || cursor != tty->cursor) {
+        kernel_log_trace("tty[%d]: refreshing rows 0x%x", tty->id, tty->dirty);
+        vga_tty_refresh(tty);
+        tty->cursor = cursor;
     }
 }
 
@@ -104,28 +122,205 @@ void tty_input(char c) {
         return;
     }
 
+    // Typing returns the view to the bottom of the output
+    tty_scroll_bottom();
+
     ringbuf_write(&active_tty->io_input, c);
 
+    // Wake readers on each character, or only on a complete line in line mode
+    if (!active_tty->line_mode || c == '\n' || ringbuf_is_full(&active_tty->io_input)) {
+        scheduler_wake(&active_tty->io_input.readers);
+    }
+
+    // Echoing makes the keyboard a second producer of the output buffer,
+    // which relies on interrupts being disabled while processes write
     if (active_tty->echo) {
         ringbuf_write(&active_tty->io_output, c);
     }
 }
 
+/**
+ * Writes characters directly to the TTY screen output
+ * @param tty - pointer to the TTY
+ * @param buf - characters to write
+ * @param n - number of characters to write
+ * @return number of characters written
+ */
+int tty_write(struct tty_t *tty, char *buf, int n) {
+    for (int i = 0; i < n; i++) {
+        tty_update(tty, buf[i]);
+    }
+
+    return n;
+}
+
+/**
+ * Returns a line of the TTY screen buffer
+ * @param tty - pointer to the TTY
+ * @param row - screen row (negative rows are in the scrollback buffer)
+ * @return pointer to the first cell of the line
+ */
+unsigned short *tty_line(struct tty_t *tty, int row) {
+    int line = (tty->line_top + row + TTY_LINES) % TTY_LINES;
+
+    return &tty->buf[line * TTY_WIDTH];
+}
+
+/**
+ * Marks a screen row as needing to be redrawn
+ * Accounts for the scrollback position of the view
+ * @param tty - pointer to the TTY
+ * @param row - screen row
+ */
+void tty_dirty(struct tty_t *tty, int row) {
+    row += tty->pos_scroll;
+
+    if (row >= 0 && row < TTY_HEIGHT) {
+        tty->dirty |= 1 << row;
+    }
+}
+
+/**
+ * Clears a line of the TTY screen buffer
+ * @param line - pointer to the first cell of the line
+ * @param attr - attribute of the blank cells
+ */
+void tty_clear_line(unsigned short *line, unsigned char attr) {
+    for (int x = 0; x < TTY_WIDTH; x++) {
+        line[x] = TTY_CELL(attr, ' ');
+    }
+}
+
+/**
+ * Returns the default attribute of the TTY
+ * @param tty - pointer to the TTY
+ * @return VGA attribute
+ */
+unsigned char tty_default_attr(struct tty_t *tty) {
+    return VGA_ATTR(tty->color_bg & 0x7, tty->color_fg);
+}
+
+/**
+ * Applies an ANSI "Select Graphic Rendition" (ESC [ ... m) sequence
+ * Supports reset, bold/bright, and the standard/bright colors
+ * @param tty - pointer to the TTY
+ */
+void tty_sgr(struct tty_t *tty) {
+    int bg = (tty->attr >> 4) & 0x7;
+    int fg = tty->attr & 0xf;
+    int n;
+
+    for (int i = 0; i <= tty->esc_count; i++) {
+        n = tty->esc_param[i];
+
+        if (n == 0) {
+            bg = tty->color_bg & 0x7;
+            fg = tty->color_fg;
+        } else if (n == 1) {
+            fg |= 0x8;
+        } else if (n == 22) {
+            fg &= 0x7;
+        } else if (n >= 30 && n <= 37) {
+            fg = (fg & 0x8) | tty_ansi_color[n - 30];
+        } else if (n == 39) {
+            fg = (fg & 0x8) | (tty->color_fg & 0x7);
+        } else if (n >= 40 && n <= 47) {
+            bg = tty_ansi_color[n - 40];
+        } else if (n == 49) {
+            bg = tty->color_bg & 0x7;
+        } else if (n >= 90 && n <= 97) {
+            fg = 0x8 | tty_ansi_color[n - 90];
+        } else if (n >= 100 && n <= 107) {
+            // The high background bit is the blink bit
+            bg = tty_ansi_color[n - 100];
+        }
+    }
+
+    tty->attr = VGA_ATTR(bg, fg);
+}
+
+/**
+ * Handles a character of an ANSI escape sequence
+ * Only SGR (color) sequences are applied; other sequences are consumed
+ * and ignored
+ * @param tty - pointer to the TTY
+ * @param c - character
+ */
+void tty_escape(struct tty_t *tty, char c) {
+    int n;
+
+    if (tty->esc_state == TTY_ESC_START) {
+        if (c == '[') {
+            tty->esc_state = TTY_ESC_CSI;
+            tty->esc_count = 0;
+            tty->esc_param[0] = 0;
+        } else {
+            tty->esc_state = TTY_ESC_NONE;
+        }
+        return;
+    }
+
+    if (c >= '0' && c <= '9') {
+        n = tty->esc_param[tty->esc_count] * 10 + (c - '0');
+        tty->esc_param[tty->esc_count] = (n > TTY_ESC_PARAM_MAX) ? TTY_ESC_PARAM_MAX : n;
+    } else if (c == ';') {
+        // Extra parameters are dropped
+        if (tty->esc_count < TTY_ESC_PARAMS - 1) {
+            tty->esc_param[++tty->esc_count] = 0;
+        }
+    } else if (c >= 0x40 && c <= 0x7e) {
+        // Final character of the sequence
+        if (c == 'm') {
+            tty_sgr(tty);
+        }
+        tty->esc_state = TTY_ESC_NONE;
+    }
+}
+
+/**
+ * Scrolls the TTY output up by one line
+ * The line that scrolls off the screen becomes part of the scrollback
+ * buffer; only the new bottom line is cleared
+ * @param tty - pointer to the TTY
+ */
+void tty_scroll(struct tty_t *tty) {
+    tty->line_top = (tty->line_top + 1) % TTY_LINES;
+
+    if (tty->line_count < TTY_SCROLLBACK) {
+        tty->line_count++;
+    }
+
+    // Keep a scrolled back view on the same lines (unless already at the oldest line)
+    if (tty->pos_scroll && tty->pos_scroll < tty->line_count) {
+        tty->pos_scroll++;
+    }
+
+    tty_clear_line(tty_line(tty, TTY_HEIGHT - 1), tty->attr);
+
+    // Every row moved
+    tty->dirty = TTY_DIRTY_ALL;
+}
+
 /**
  * Updates the TTY with the given character
+ * @param tty - pointer to the TTY
  * @param c - character to update on the TTY screen output
  */
-void tty_update(char c) {
-    if (!active_tty) {
+void tty_update(struct tty_t *tty, char c) {
+    if (!tty) {
         return;
     }
 
-    struct tty_t *tty = active_tty;
-
-//    kernel_log_debug("tty[%d]: input char=%c", tty->id, c);
-//    kernel_log_debug("  before scroll=%d, x=%d, y=%d", tty->pos_scroll, tty->pos_x, tty->pos_y);
+    if (tty->esc_state != TTY_ESC_NONE) {
+        tty_escape(tty, c);
+        return;
+    }
 
     switch (c) {
+        case '\033':
+            tty->esc_state = TTY_ESC_START;
+            break;
+
         case '\t':
             tty->pos_x += 4 - tty->pos_x % 4;
             break;
@@ -149,30 +344,64 @@ void tty_update(char c) {
             break;
 
         default:
-            tty->buf[(tty->pos_scroll * TTY_WIDTH) + (tty->pos_x + tty->pos_y * TTY_WIDTH)] = c;
+            tty_line(tty, tty->pos_y)[tty->pos_x] = TTY_CELL(tty->attr, c);
+            tty_dirty(tty, tty->pos_y);
             tty->pos_x++;
             break;
     }
 
+    // Wrap long lines so the character position (and dirty row) stays on screen
+    if (tty->pos_x >= TTY_WIDTH) {
+        tty->pos_x = 0;
+        tty->pos_y++;
+    }
+
     if (tty->pos_y >= TTY_HEIGHT) {
-        int x;
-        int y;
+        tty_scroll(tty);
+        tty->pos_y = TTY_HEIGHT - 1;
+    }
+}
 
-        for (x = 0; x < TTY_WIDTH; x++) {
-            for (y = 1; y < TTY_HEIGHT; y++) {
-                tty->buf[TTY_WIDTH * (y - 1) + x] = tty->buf[TTY_WIDTH * y + x];
-            }
-        }
+/**
+ * Scrolls the TTY up one line into the scrollback buffer
+ * If the buffer is at the top, it will not scroll up further
+ */
+void tty_scroll_up(void) {
+    if (active_tty && active_tty->pos_scroll < active_tty->line_count) {
+        active_tty->pos_scroll++;
+        active_tty->dirty = TTY_DIRTY_ALL;
+    }
+}
 
-        for (x = 0; x < TTY_WIDTH; x++) {
-            tty->buf[TTY_WIDTH * (y - 1) + x] = ' ';
-        }
+/**
+ * Scrolls the TTY down one line into the scrollback buffer
+ * If the buffer is at the end, it will not scroll down further
+ */
+void tty_scroll_down(void) {
+    if (active_tty && active_tty->pos_scroll > 0) {
+        active_tty->pos_scroll--;
+        active_tty->dirty = TTY_DIRTY_ALL;
+    }
+}
 
-        tty->pos_y = TTY_HEIGHT - 1;
+/**
+ * Scrolls to the top of the buffer
+ */
+void tty_scroll_top(void) {
+    if (active_tty && active_tty->pos_scroll != active_tty->line_count) {
+        active_tty->pos_scroll = active_tty->line_count;
+        active_tty->dirty = TTY_DIRTY_ALL;
     }
+}
 
-//    kernel_log_debug("  after: scroll=%d, x=%d, y=%d", tty->pos_scroll, tty->pos_x, tty->pos_y);
-    tty->refresh = 1;
+/**
+ * Scrolls to the bottom of the buffer
+ */
+void tty_scroll_bottom(void) {
+    if (active_tty && active_tty->pos_scroll != 0) {
+        active_tty->pos_scroll = 0;
+        active_tty->dirty = TTY_DIRTY_ALL;
+    }
 }
 
 /**
@@ -189,11 +418,19 @@ void tty_init(void) {
         tty_table[i].color_bg = VGA_COLOR_BLACK;
         tty_table[i].color_fg = VGA_COLOR_LIGHT_GREY;
         tty_table[i].echo = 0;
+        tty_table[i].cursor = -1;
+        tty_table[i].attr = tty_default_attr(&tty_table[i]);
+
+        for (int line = 0; line < TTY_LINES; line++) {
+            tty_clear_line(tty_line(&tty_table[i], line), tty_table[i].attr);
+        }
     }
 
     // Select tty 0 to start with
     tty_select(0);
 
     // Update the screen on a regular interval (50 times per second right now)
-    timer_callback_register(tty_refresh, 2, -1);
+    // Output produced while idle is displayed when the CPU wakes
+    work_init(&tty_refresh_work, tty_refresh, 0);
+    workqueue_schedule_periodic(WORKQUEUE_DISPLAY, &tty_refresh_work, TIMER_HZ / 50);
 }
@@ -0,0 +1,78 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Shared Kernel Data Page (vDSO)
+ */
+#include <spede/string.h>
+
+#include "kernel.h"
+#include "timer.h"
+#include "vdso.h"
+
+// Shared data page
+// Processes share the kernel's flat address space, so the page can not be
+// mapped read-only; user code only accesses it through the vdso_read_*
+// helpers
+vdso_data_t vdso_data __attribute__((aligned(VDSO_PAGE_SIZE)));
+
+/**
+ * Marks the start of an update to the shared data
+ */
+void vdso_write_begin(void) {
+    vdso_data.seq++;
+    asm volatile("" ::: "memory");
+}
+
+/**
+ * Marks the end of an update to the shared data
+ */
+void vdso_write_end(void) {
+    asm volatile("" ::: "memory");
+    vdso_data.seq++;
+}
+
+/**
+ * Returns the shared data page
+ * @return pointer to the shared data page
+ */
+vdso_data_t *vdso_get(void) {
+    return &vdso_data;
+}
+
+/**
+ * Publishes the current timer tick count
+ * @param ticks - timer ticks since startup
+ */
+void vdso_update_ticks(int ticks) {
+    vdso_write_begin();
+    vdso_data.ticks = ticks;
+    vdso_write_end();
+}
+
+/**
+ * Publishes the TSC calibration
+ * @param base - TSC value at time zero
+ * @param mult - TSC to nanosecond multiplier (0 if the TSC is unusable)
+ * @param shift - TSC to nanosecond shift
+ */
+void vdso_update_tsc(unsigned long long base, unsigned int mult, unsigned int shift) {
+    vdso_write_begin();
+    vdso_data.tsc_base = base;
+    vdso_data.tsc_mult = mult;
+    vdso_data.tsc_shift = shift;
+    vdso_write_end();
+}
+
+/**
+ * Initializes the shared data page
+ */
+void vdso_init(void) {
+    kernel_log_info("Initializing shared data page");
+
+    memset(&vdso_data, 0, sizeof(vdso_data));
+
+    vdso_data.hz = TIMER_HZ;
+    vdso_data.ns_per_tick = TIMER_NS_PER_TICK;
+    strncpy(vdso_data.os_name, OS_NAME, VDSO_NAME_LEN - 1);
+}
@@ -4,13 +4,24 @@
  *
  */
 
+// Log messages from this file belong to the tty subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_TTY
+
 #include <spede/machine/io.h>
 #include <spede/stdarg.h>
 #include <spede/stdio.h>
+#include <spede/string.h>
 
+#include "interrupts.h"
 #include "kernel.h"
+#include "timer.h"
 #include "tty.h"
 #include "vga.h"
+#include "workqueue.h"
+
+#if VGA_FLUSH_HZ > TIMER_HZ
+#error "VGA_FLUSH_HZ must not exceed TIMER_HZ"
+#endif
 
 // VGA Address Port -> Set the register address to write data into
 #define VGA_PORT_ADDR 0x3D4
@@ -33,9 +44,190 @@ int vga_color_fg = VGA_COLOR_LIGHT_GREY;
 // VGA text mode cursor status
 int vga_cursor = 0;
 
+// Requested cursor position (x + y * VGA_WIDTH), applied by vga_flush()
+int vga_cursor_pos = 0;
+
+// Cursor position last written to the CRT controller, -1 if unknown
+int vga_cursor_hw = -1;
+
+// Work item that flushes the shadow framebuffer
+work_t vga_flush_work;
+
 // Optionally enable/disable scrolling
 int vga_scroll = 0;
 
+// Off-screen (shadow) framebuffer that all output is rendered into
+// Changed cells are copied to VGA memory once per frame by vga_flush()
+unsigned short vga_shadow[VGA_WIDTH * VGA_HEIGHT];
+
+// Changed span of each row in the shadow framebuffer: [start, end) columns
+// A row is unchanged when start >= end
+int vga_span_start[VGA_HEIGHT];
+int vga_span_end[VGA_HEIGHT];
+
+/**
+ * Marks a cell of the shadow framebuffer as changed
+ * @param pos - cell position (x + y * VGA_WIDTH)
+ */
+static void vga_mark(int pos) {
+    int x = pos % VGA_WIDTH;
+    int y = pos / VGA_WIDTH;
+
+    if (vga_span_start[y] >= vga_span_end[y]) {
+        vga_span_start[y] = x;
+        vga_span_end[y] = x + 1;
+    } else if (x < vga_span_start[y]) {
+        vga_span_start[y] = x;
+    } else if (x >= vga_span_end[y]) {
+        vga_span_end[y] = x + 1;
+    }
+}
+
+/**
+ * Marks entire rows of the shadow framebuffer as changed
+ * @param y - first row
+ * @param n - number of rows
+ */
+static void vga_mark_rows(int y, int n) {
+    for (int i = y; i < y + n && i < VGA_HEIGHT; i++) {
+        vga_span_start[i] = 0;
+        vga_span_end[i] = VGA_WIDTH;
+    }
+}
+
+/**
+ * Stores a cell in the shadow framebuffer
+ * Cells that do not change are not copied to VGA memory again
+ * @param pos - cell position (x + y * VGA_WIDTH)
+ * @param cell - VGA character and attribute
+ */
+static void vga_store(int pos, unsigned short cell) {
+    // Output past the end of the screen (scrolling disabled) is dropped
+    if (pos >= VGA_WIDTH * VGA_HEIGHT) {
+        return;
+    }
+
+    if (vga_shadow[pos] != cell) {
+        vga_shadow[pos] = cell;
+        vga_mark(pos);
+    }
+}
+
+/**
+ * Copies 32-bit words to VGA memory
+ * @param dst - destination address
+ * @param src - source address
+ * @param n - number of 32-bit words
+ */
+static inline void vga_blit(void *dst, void *src, int n) {
+    asm volatile ("cld; rep movsl"
+                  : "+D" (dst), "+S" (src), "+c" (n)
+                  :
+                  : "memory");
+}
+
+/**
+ * Takes the changed spans to be flushed
+ * Must be called with interrupts disabled; changes made afterwards are
+ * left for the next flush
+ * @param span_start - first changed column of each row
+ * @param span_end - end of the changed columns of each row
+ */
+static void vga_flush_take(int *span_start, int *span_end) {
+    memcpy(span_start, vga_span_start, sizeof(vga_span_start));
+    memcpy(span_end, vga_span_end, sizeof(vga_span_end));
+    memset(vga_span_start, 0, sizeof(vga_span_start));
+    memset(vga_span_end, 0, sizeof(vga_span_end));
+}
+
+/**
+ * Copies the given spans of the shadow framebuffer to VGA memory
+ * Spans are widened to 32-bit boundaries and spans that continue onto
+ * the next row are combined into a single copy
+ * @param span_start - first changed column of each row
+ * @param span_end - end of the changed columns of each row
+ */
+static void vga_flush_copy(int *span_start, int *span_end) {
+    unsigned short *vga_buf = VGA_BASE;
+    int start;
+    int end;
+    int y = 0;
+
+    while (y < VGA_HEIGHT) {
+        if (span_start[y] >= span_end[y]) {
+            y++;
+            continue;
+        }
+
+        // Two cells per 32-bit word
+        start = y * VGA_WIDTH + (span_start[y] & ~1);
+        end = y * VGA_WIDTH + ((span_end[y] + 1) & ~1);
+        y++;
+
+        // Extend the copy while the span runs into the next row
+        while (y < VGA_HEIGHT && end == y * VGA_WIDTH
+               && span_start[y] == 0 && span_end[y] > 0) {
+            end = y * VGA_WIDTH + ((span_end[y] + 1) & ~1);
+            y++;
+        }
+
+        vga_blit(&vga_buf[start], &vga_shadow[start], (end - start) / 2);
+    }
+}
+
+/**
+ * Moves the hardware cursor to the requested position
+ * Must be called with interrupts disabled since the CRT controller
+ * registers are written through a shared index/data port pair
+ */
+static void vga_flush_cursor(void) {
+    // Port I/O is slow, so only registers whose value changed are written
+    if (vga_cursor && vga_cursor_pos != vga_cursor_hw) {
+        if (vga_cursor_hw < 0 || (vga_cursor_pos & 0xFF) != (vga_cursor_hw & 0xFF)) {
+            outportb(VGA_PORT_ADDR, 0x0F);
+            outportb(VGA_PORT_DATA, (unsigned char) (vga_cursor_pos & 0xFF));
+        }
+
+        if (vga_cursor_hw < 0 || (vga_cursor_pos >> 8) != (vga_cursor_hw >> 8)) {
+            outportb(VGA_PORT_ADDR, 0x0E);
+            outportb(VGA_PORT_DATA, (unsigned char) ((vga_cursor_pos >> 8) & 0xFF));
+        }
+
+        vga_cursor_hw = vga_cursor_pos;
+    }
+}
+
+/**
+ * Copies the changed spans of the shadow framebuffer to VGA memory
+ * Must be called with interrupts disabled
+ */
+void vga_flush(void) {
+    int span_start[VGA_HEIGHT];
+    int span_end[VGA_HEIGHT];
+
+    vga_flush_take(span_start, span_end);
+    vga_flush_copy(span_start, span_end);
+    vga_flush_cursor();
+}
+
+/**
+ * Flush work function
+ * The changed spans are taken and the cursor is moved with interrupts
+ * disabled; VGA memory is then copied with interrupts enabled. Output
+ * drawn while copying is marked again and is copied by the next flush
+ */
+static void vga_flush_work_run(void) {
+    int span_start[VGA_HEIGHT];
+    int span_end[VGA_HEIGHT];
+
+    interrupts_disable();
+    vga_flush_take(span_start, span_end);
+    vga_flush_cursor();
+    interrupts_enable();
+
+    vga_flush_copy(span_start, span_end);
+}
+
 /**
  * Initializes the VGA driver and configuration
  *  - Defaults variables
@@ -54,6 +246,11 @@ void vga_init(void) {
 
     // Clear the screen
     vga_clear();
+
+    // Copy the shadow framebuffer to VGA memory once per frame
+    // Nothing changes on screen while the CPU is idle
+    work_init(&vga_flush_work, vga_flush_work_run, WORK_PREEMPTIBLE);
+    workqueue_schedule_periodic(WORKQUEUE_DISPLAY, &vga_flush_work, TIMER_HZ / VGA_FLUSH_HZ);
 }
 
 /**
@@ -61,26 +258,32 @@ void vga_init(void) {
  * position if the cursor is enabled.
  */
 void vga_cursor_update(void) {
-    if (vga_cursor) {
-        unsigned short pos = vga_pos_x + vga_pos_y * VGA_WIDTH;
+    vga_cursor_move(vga_pos_x, vga_pos_y);
+}
 
-        outportb(VGA_PORT_ADDR, 0x0F);
-        outportb(VGA_PORT_DATA, (unsigned char) (pos & 0xFF));
-        outportb(VGA_PORT_ADDR, 0x0E);
-        outportb(VGA_PORT_DATA, (unsigned char) ((pos >> 8) & 0xFF));
-    }
+/**
+ * Moves the cursor to the specified position if the cursor is enabled
+ * Does not change the "current" x/y position
+ * The CRT controller is only updated by the next vga_flush() so repeated
+ * moves within a frame are coalesced
+ *
+ * @param x - x position (0 to VGA_WIDTH-1)
+ * @param y - y position (0 to VGA_HEIGHT-1)
+ */
+void vga_cursor_move(int x, int y) {
+    vga_cursor_pos = (x + y * VGA_WIDTH) & 0xFFFF;
 }
 
 /**
  * Clears the VGA output and sets the background and foreground colors
  */
 void vga_clear(void) {
-    unsigned short *vga_buf = VGA_BASE;
-
     for (unsigned int i = 0; i < (VGA_WIDTH * VGA_HEIGHT); i++) {
-        vga_buf[i] = VGA_CHAR(vga_color_bg, vga_color_fg, 0x00);
+        vga_shadow[i] = VGA_CHAR(vga_color_bg, vga_color_fg, 0x00);
     }
 
+    vga_mark_rows(0, VGA_HEIGHT);
+
     vga_set_xy(0, 0);
 }
 
@@ -174,29 +377,16 @@ int vga_get_fg(void) {
  * @param c - Character to print
  */
 void vga_setc(char c) {
-    unsigned short *vga_buf = VGA_BASE;
-    vga_buf[vga_pos_x + vga_pos_y * VGA_WIDTH] = VGA_CHAR(vga_color_bg, vga_color_fg, c);
+    vga_store(vga_pos_x + vga_pos_y * VGA_WIDTH, VGA_CHAR(vga_color_bg, vga_color_fg, (unsigned char)c));
 }
 
 /**
- * Prints a character on the screen.
- *
- * When a character is printed, will do the following:
- *  - Update the x and y positions
- *  - If needed, will wrap from the end of the current line to the
- *    start of the next line
- *  - If the last line is reached, will ensure that all text is
- *    scrolled up
- *  - Special characters are handled as such:
- *    - tab character (\t) prints 'tab_stop' spaces
- *    - backspace (\b) character moves the character back one position,
- *      prints a space, and then moves back one position again
+ * Prints a character into the shadow framebuffer and updates the x/y
+ * position without moving the cursor
  *
  * @param c - character to print
  */
-void vga_putc(char c) {
-    unsigned short *vga_buf = VGA_BASE;
-
+static void vga_output(char c) {
     // Handle scecial characters
     switch (c) {
         case '\b':
@@ -207,7 +397,7 @@ void vga_putc(char c) {
                 vga_pos_x = VGA_WIDTH-1;
             }
 
-            vga_buf[vga_pos_x + vga_pos_y * VGA_WIDTH] = VGA_CHAR(vga_color_bg, vga_color_fg, 0x00);
+            vga_store(vga_pos_x + vga_pos_y * VGA_WIDTH, VGA_CHAR(vga_color_bg, vga_color_fg, 0x00));
             break;
 
         case '\t':
@@ -224,7 +414,7 @@ void vga_putc(char c) {
             break;
 
         default:
-            vga_buf[vga_pos_x + vga_pos_y * VGA_WIDTH] = VGA_CHAR(vga_color_bg, vga_color_fg, c);
+            vga_store(vga_pos_x + vga_pos_y * VGA_WIDTH, VGA_CHAR(vga_color_bg, vga_color_fg, (unsigned char)c));
             vga_pos_x++;
             break;
     }
@@ -239,20 +429,39 @@ void vga_putc(char c) {
         // Handle end of rows
         if (vga_pos_y >= VGA_HEIGHT) {
             // Scroll the screen up (copy each row to the previous)
-            for (unsigned int i = 0; i < VGA_WIDTH * (VGA_HEIGHT - 1); i++) {
-                vga_buf[i] = vga_buf[VGA_WIDTH + i];
-            }
+            memmove(vga_shadow, &vga_shadow[VGA_WIDTH], VGA_WIDTH * (VGA_HEIGHT - 1) * sizeof(unsigned short));
 
             // Clear the last line
             for (unsigned int i = 0; i < VGA_WIDTH; i++) {
-                vga_buf[i + (VGA_WIDTH * (VGA_HEIGHT-1))] = VGA_CHAR(vga_color_bg, vga_color_fg, ' ');
+                vga_shadow[i + (VGA_WIDTH * (VGA_HEIGHT-1))] = VGA_CHAR(vga_color_bg, vga_color_fg, ' ');
             }
 
+            vga_mark_rows(0, VGA_HEIGHT);
+
             vga_pos_y = VGA_HEIGHT - 1;
         }
 
     }
+}
 
+/**
+ * Prints a character on the screen.
+ *
+ * When a character is printed, will do the following:
+ *  - Update the x and y positions
+ *  - If needed, will wrap from the end of the current line to the
+ *    start of the next line
+ *  - If the last line is reached, will ensure that all text is
+ *    scrolled up
+ *  - Special characters are handled as such:
+ *    - tab character (\t) prints 'tab_stop' spaces
+ *    - backspace (\b) character moves the character back one position,
+ *      prints a space, and then moves back one position again
+ *
+ * @param c - character to print
+ */
+void vga_putc(char c) {
+    vga_output(c);
     vga_cursor_update();
 }
 
@@ -268,9 +477,12 @@ void vga_puts(char *s) {
     }
 
     while (*s != '\0') {
-        vga_putc(*s);
+        vga_output(*s);
         s++;
     }
+
+    // Update the cursor once for the whole string
+    vga_cursor_update();
 }
 
 /**
@@ -279,6 +491,7 @@ void vga_puts(char *s) {
  *
  * Does not change the "current" x/y position
  * Does not change the "current" background/foreground colors
+ * The character is stored as-is (special characters are not interpreted)
  *
  * @param x - x position (0 to VGA_WIDTH-1)
  * @param y - y position (0 to VGA_HEIGHT-1)
@@ -287,41 +500,19 @@ void vga_puts(char *s) {
  * @param c - character to print
  */
 void vga_putc_at(int x, int y, int bg, int fg, char c) {
-    int cur_x = vga_pos_x;
-    int cur_y = vga_pos_y;
-    int cur_bg = vga_color_bg;
-    int cur_fg = vga_color_fg;
-    int cur_cursor = vga_cursor;
-
     if (x < 0) {
         x = 0;
     } else if (x >= VGA_WIDTH) {
         x = VGA_WIDTH - 1;
-    } else {
-        x = x;
     }
 
     if (y < 0) {
         y = 0;
     } else if (y >= VGA_HEIGHT) {
         y = VGA_HEIGHT - 1;
-    } else {
-        y = y;
     }
 
-    vga_pos_x = x;
-    vga_pos_y = y;
-    vga_color_bg = bg & 0x7;
-    vga_color_fg = fg & 0xf;
-    vga_cursor = 0;
-
-    vga_putc(c);
-
-    vga_pos_x = cur_x;
-    vga_pos_y = cur_y;
-    vga_color_bg = cur_bg;
-    vga_color_fg = cur_fg;
-    vga_cursor = cur_cursor;
+    vga_store(x + y * VGA_WIDTH, VGA_CHAR(bg & 0x7, fg & 0xf, (unsigned char)c));
 }
 
 /**
@@ -329,6 +520,8 @@ void vga_putc_at(int x, int y, int bg, int fg, char c) {
  * with the specified background/foreground colors
  *
  * Does not change the "current" x/y position or background/foreground colors
+ * Characters are stored as-is, wrapping at the end of each row and
+ * stopping at the end of the screen
  *
  * @param x - x position (0 to VGA_WIDTH-1)
  * @param y - y position (0 to VGA_HEIGHT-1)
@@ -337,44 +530,24 @@ void vga_putc_at(int x, int y, int bg, int fg, char c) {
  * @param c - character to print
  */
 void vga_puts_at(int x, int y, int bg, int fg, char *s) {
-    int cur_x = vga_pos_x;
-    int cur_y = vga_pos_y;
-    int cur_bg = vga_color_bg;
-    int cur_fg = vga_color_fg;
-    int cur_cursor = 0;
+    unsigned short attr = VGA_CHAR(bg & 0x7, fg & 0xf, 0);
+    int pos;
 
     if (x < 0) {
         x = 0;
     } else if (x >= VGA_WIDTH) {
         x = VGA_WIDTH - 1;
-    } else {
-        x = x;
     }
 
     if (y < 0) {
         y = 0;
     } else if (y >= VGA_HEIGHT) {
-        y = VGA_HEIGHT- 1;
-    } else {
-        y = y;
+        y = VGA_HEIGHT - 1;
     }
 
-    vga_pos_x = x;
-    vga_pos_y = y;
-    vga_color_bg = bg & 0x7;
-    vga_color_fg = fg & 0xf;
-    vga_cursor = 0;
-
-    while (*s != '\0') {
-        vga_putc(*s);
-        s++;
+    for (pos = x + y * VGA_WIDTH; *s != '\0' && pos < VGA_WIDTH * VGA_HEIGHT; s++, pos++) {
+        vga_store(pos, attr | (unsigned char)*s);
     }
-
-    vga_pos_x = cur_x;
-    vga_pos_y = cur_y;
-    vga_color_bg = cur_bg;
-    vga_color_fg = cur_fg;
-    vga_cursor = cur_cursor;
 }
 
 /**
@@ -383,6 +556,9 @@ void vga_puts_at(int x, int y, int bg, int fg, char *s) {
 void vga_cursor_enable(void) {
     vga_cursor = 1;
 
+    // Ensure the cursor position is written on the next flush
+    vga_cursor_hw = -1;
+
     // The cursor will be drawn between the scanlines defined
     // in the "Cursor Start Register" (0x0A) and the
     // "Cursor End Register" (0x0B)
@@ -412,3 +588,29 @@ void vga_cursor_disable(void) {
     outportb(VGA_PORT_DATA, 0x20);
 }  
  
+
+/**
+ * Refresh the VGA for the given TTY
+ *
+ * Writes each dirty row of the TTY to the shadow framebuffer and then
+ * moves the cursor once
+ *
+ * @param tty - pointer to the TTY
+ */
+void vga_tty_refresh(tty_t *tty) {
+    for (int y = 0; y < TTY_HEIGHT && y < VGA_HEIGHT; y++) {
+        if (!(tty->dirty & (1 << y))) {
+            continue;
+        }
+
+        // TTY cells are stored in the VGA format
+        memcpy(&vga_shadow[y * VGA_WIDTH], tty_line(tty, y - tty->pos_scroll),
+               VGA_WIDTH * sizeof(unsigned short));
+        vga_mark_rows(y, 1);
+    }
+
+    tty->dirty = 0;
+
+    // The cursor is off screen (hidden) when scrolled back past it
+    vga_cursor_move(tty->pos_x, tty->pos_y + tty->pos_scroll);
+}
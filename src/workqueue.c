@@ -0,0 +1,236 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Kernel Work Queues
+ *
+ * Interrupt handlers and timer callbacks queue work items that are run
+ * later by a worker process, after the interrupt has been dismissed.
+ * Each work queue has its own worker process, so the priority of the
+ * worker determines the priority of the work.
+ */
+
+// Log messages from this file belong to the workqueue subsystem
+#define KERNEL_LOG_SUBSYS KERNEL_LOG_SUBSYS_WORKQUEUE
+
+#include <spede/string.h>
+
+#include "interrupts.h"
+#include "kernel.h"
+#include "ksem.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "workqueue.h"
+
+// Work queue table
+workqueue_t workqueues[WORKQUEUE_MAX];
+
+/**
+ * Worker process
+ * Runs the work items of the work queue that it belongs to, in order
+ */
+void workqueue_worker(void) {
+    workqueue_t *wq = NULL;
+    work_t *work;
+    int pid = proc_get_pid();
+
+    for (int i = 0; i < WORKQUEUE_MAX; i++) {
+        if (workqueues[i].allocated && workqueues[i].worker->pid == pid) {
+            wq = &workqueues[i];
+        }
+    }
+
+    if (!wq) {
+        proc_exit(-1);
+    }
+
+    while (1) {
+        // Blocks until a work item is pending
+        sem_wait(wq->sem);
+
+        // The kernel is not reentrant, so work runs with interrupts
+        // disabled unless it is preemptible; pending interrupts are
+        // serviced between work items
+        interrupts_disable();
+
+        work = wq->head;
+        if (!work) {
+            interrupts_enable();
+            continue;
+        }
+
+        wq->head = work->next;
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+
+        // The work may be queued again while it runs
+        work->next = NULL;
+        work->pending = 0;
+
+        if (work->flags & WORK_PREEMPTIBLE) {
+            interrupts_enable();
+        }
+
+        work->func();
+
+        interrupts_enable();
+    }
+}
+
+/**
+ * Timer event function for periodic work
+ * @param data - pointer to the work item
+ */
+void workqueue_periodic_expired(void *data) {
+    work_t *work = data;
+
+    workqueue_schedule(work->queue, work);
+    timer_event_add(&work->event, work->interval);
+}
+
+/**
+ * Creates a work queue and its worker process
+ * @param name - name of the worker process
+ * @param priority - scheduling priority of the worker process
+ * @return work queue id, -1 on error
+ */
+int workqueue_create(char *name, int priority) {
+    workqueue_t *wq = NULL;
+    int id;
+
+    for (id = 0; id < WORKQUEUE_MAX; id++) {
+        if (!workqueues[id].allocated) {
+            wq = &workqueues[id];
+            break;
+        }
+    }
+
+    if (!wq) {
+        kernel_log_error("workqueue: unable to allocate a work queue");
+        return -1;
+    }
+
+    wq->sem = ksem_init(0);
+    if (wq->sem < 0) {
+        kernel_log_error("workqueue: unable to allocate a semaphore");
+        return -1;
+    }
+
+    wq->worker = pid_to_proc(kproc_create(workqueue_worker, name, PROC_TYPE_KERNEL));
+    if (!wq->worker) {
+        ksem_destroy(wq->sem);
+        kernel_log_error("workqueue: unable to create the worker process");
+        return -1;
+    }
+
+    scheduler_set_priority(wq->worker, priority);
+
+    wq->head = NULL;
+    wq->tail = NULL;
+    wq->allocated = 1;
+
+    kernel_log_info("workqueue: created %s (%d) with priority %d", name, id, priority);
+
+    return id;
+}
+
+/**
+ * Initializes a work item
+ * @param work - pointer to the work item
+ * @param func - function to run
+ * @param flags - work flags
+ */
+void work_init(work_t *work, void (*func)(void), int flags) {
+    memset(work, 0, sizeof(work_t));
+    work->func = func;
+    work->flags = flags;
+}
+
+/**
+ * Queues a work item to be run by a work queue
+ * Has no effect if the work item is already pending
+ * Must be called from the kernel (interrupts disabled)
+ * @param id - work queue id
+ * @param work - pointer to the work item
+ * @return 0 on success, -1 on error
+ */
+int workqueue_schedule(int id, work_t *work) {
+    workqueue_t *wq;
+
+    if (id < 0 || id >= WORKQUEUE_MAX || !workqueues[id].allocated || !work || !work->func) {
+        kernel_log_error("workqueue: invalid work queue %d or work item", id);
+        return -1;
+    }
+
+    if (work->pending) {
+        return 0;
+    }
+
+    wq = &workqueues[id];
+
+    work->next = NULL;
+    work->pending = 1;
+
+    if (wq->tail) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+
+    // Wake the worker
+    ksem_post(wq->sem);
+
+    return 0;
+}
+
+/**
+ * Queues a work item at a regular interval
+ * Periodic work does not wake the CPU from tickless idle
+ * @param id - work queue id
+ * @param work - pointer to the work item
+ * @param interval - number of ticks between runs
+ * @return 0 on success, -1 on error
+ */
+int workqueue_schedule_periodic(int id, work_t *work, int interval) {
+    if (id < 0 || id >= WORKQUEUE_MAX || !workqueues[id].allocated || !work || !work->func) {
+        kernel_log_error("workqueue: invalid work queue %d or work item", id);
+        return -1;
+    }
+
+    if (interval < 1) {
+        kernel_log_error("workqueue: invalid interval %d", interval);
+        return -1;
+    }
+
+    work->queue = id;
+    work->interval = interval;
+
+    // Run on tick counts that are a multiple of the interval (like timer callbacks)
+    work->event.func = workqueue_periodic_expired;
+    work->event.data = work;
+    work->event.deferrable = 1;
+    timer_event_add(&work->event, interval - (timer_get_ticks() % interval));
+
+    return 0;
+}
+
+/**
+ * Initializes the work queues and creates the predefined work queues
+ */
+void workqueue_init(void) {
+    kernel_log_info("Initializing work queues");
+
+    memset(workqueues, 0, sizeof(workqueues));
+
+    // Input is handled ahead of everything else
+    if (workqueue_create("kworker/high", PROC_PRIORITY_MAX) != WORKQUEUE_HIGH) {
+        kernel_panic("Unable to create the high priority work queue");
+    }
+
+    // Screen updates run just ahead of user processes
+    if (workqueue_create("kworker/display", PROC_PRIORITY_DEFAULT - 1) != WORKQUEUE_DISPLAY) {
+        kernel_panic("Unable to create the display work queue");
+    }
+}
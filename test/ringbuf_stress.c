@@ -0,0 +1,176 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Ring buffer SPSC stress test (host)
+ *
+ * Builds src/ringbuf.c with the host compiler and runs a producer and a
+ * consumer thread against the same ring buffer without any locking. The
+ * producer writes a known byte sequence using both single byte and bulk
+ * writes of varying sizes; the consumer reads it back the same way and
+ * verifies that every byte arrives exactly once and in order.
+ *
+ * Usage: make -C test && ./test/ringbuf_stress [bytes]
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ringbuf.h"
+
+// Default number of bytes transferred
+#define STRESS_BYTES    (64UL * 1024 * 1024)
+
+// Largest bulk transfer (larger than the buffer to exercise partial copies)
+#define STRESS_CHUNK    (RINGBUF_SIZE + RINGBUF_SIZE / 2)
+
+// Shared ring buffer
+ringbuf_t stress_buf;
+
+// Number of bytes to transfer
+unsigned long stress_bytes = STRESS_BYTES;
+
+/**
+ * Returns the expected byte at a position in the stream
+ * A prime period keeps the pattern from lining up with the buffer size
+ * @param pos - position in the stream
+ * @return byte value
+ */
+static char stress_byte(unsigned long pos) {
+    return (char)(pos % 251);
+}
+
+/**
+ * Returns the next transfer size
+ * Size 1 uses the single byte functions
+ * @param seed - pointer to the generator state
+ * @return transfer size (1 to STRESS_CHUNK)
+ */
+static size_t stress_size(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return ((*seed >> 16) % STRESS_CHUNK) + 1;
+}
+
+/**
+ * Producer thread
+ * @param arg - unused
+ */
+static void *stress_producer(void *arg) {
+    char chunk[STRESS_CHUNK];
+    unsigned long pos = 0;
+    unsigned int seed = 1;
+    size_t size;
+    int rc;
+
+    while (pos < stress_bytes) {
+        size = stress_size(&seed);
+        if (size > stress_bytes - pos) {
+            size = stress_bytes - pos;
+        }
+
+        if (size == 1) {
+            if (ringbuf_write(&stress_buf, stress_byte(pos)) == 0) {
+                pos++;
+            } else {
+                sched_yield();
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            chunk[i] = stress_byte(pos + i);
+        }
+
+        rc = ringbuf_write_mem(&stress_buf, chunk, size);
+        if (rc < 0 || (size_t)rc > size) {
+            fprintf(stderr, "ringbuf_write_mem returned %d for %zu bytes\n", rc, size);
+            exit(1);
+        }
+
+        // Let the consumer run when the buffer is full
+        if (rc == 0) {
+            sched_yield();
+        }
+
+        pos += rc;
+    }
+
+    return NULL;
+}
+
+/**
+ * Consumer thread
+ * @param arg - unused
+ */
+static void *stress_consumer(void *arg) {
+    char chunk[STRESS_CHUNK];
+    unsigned long pos = 0;
+    unsigned int seed = 2;
+    size_t size;
+    char byte;
+    int rc;
+
+    while (pos < stress_bytes) {
+        size = stress_size(&seed);
+
+        if (size == 1) {
+            if (ringbuf_read(&stress_buf, &byte) == 0) {
+                chunk[0] = byte;
+                rc = 1;
+            } else {
+                rc = 0;
+            }
+        } else {
+            rc = ringbuf_read_mem(&stress_buf, chunk, size);
+            if (rc < 0 || (size_t)rc > size) {
+                fprintf(stderr, "ringbuf_read_mem returned %d for %zu bytes\n", rc, size);
+                exit(1);
+            }
+        }
+
+        // Let the producer run when the buffer is empty
+        if (rc == 0) {
+            sched_yield();
+        }
+
+        for (int i = 0; i < rc; i++, pos++) {
+            if (chunk[i] != stress_byte(pos)) {
+                fprintf(stderr, "mismatch at byte %lu: expected %d, read %d\n",
+                        pos, stress_byte(pos), chunk[i]);
+                exit(1);
+            }
+        }
+    }
+
+    if (!ringbuf_is_empty(&stress_buf)) {
+        fprintf(stderr, "buffer not empty after reading every byte\n");
+        exit(1);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    pthread_t producer;
+    pthread_t consumer;
+
+    if (argc > 1) {
+        stress_bytes = strtoul(argv[1], NULL, 0);
+    }
+
+    ringbuf_init(&stress_buf);
+
+    if (pthread_create(&consumer, NULL, stress_consumer, NULL) != 0
+        || pthread_create(&producer, NULL, stress_producer, NULL) != 0) {
+        fprintf(stderr, "unable to create threads\n");
+        return 1;
+    }
+
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    printf("ringbuf_stress: %lu bytes transferred in order\n", stress_bytes);
+
+    return 0;
+}
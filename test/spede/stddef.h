@@ -0,0 +1,7 @@
+/**
+ * CPE/CSC 159 - Operating System Pragmatics
+ * California State University, Sacramento
+ *
+ * Host build shim: maps the SPEDE header to the host C library
+ */
+#include <stddef.h>